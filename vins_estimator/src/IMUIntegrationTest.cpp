@@ -0,0 +1,152 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <ros/ros.h>
+#include "estimator/parameters.h"
+#include "factor/integration_base.h"
+#include "utility/tic_toc.h"
+
+using namespace std;
+using namespace Eigen;
+
+/**预积分积分策略的精度-耗时对比。
+ * 以原始频率IMU数据为输入，每两个数据之间线性插值并细分为若干子步做RK4积分，作为参考值；
+ * 再将数据按1、2、4倍降采样，用各策略做预积分，统计每个时间窗口内delta_p/v/q相对参考值的误差
+**/
+
+struct Window
+{
+    Vector3d delta_p, delta_v;
+    Quaterniond delta_q;
+};
+
+const int REF_SUBSTEPS = 16;
+
+Window integrateReference(const vector<double> &t, const vector<Vector3d> &acc, const vector<Vector3d> &gyr, int begin, int end)
+{
+    Window w;
+    w.delta_p.setZero();
+    w.delta_v.setZero();
+    w.delta_q.setIdentity();
+    for (int i = begin; i < end; i++)
+    {
+        double h = (t[i + 1] - t[i]) / REF_SUBSTEPS;
+        for (int k = 0; k < REF_SUBSTEPS; k++)
+        {
+            double s0 = double(k) / REF_SUBSTEPS, s1 = double(k + 1) / REF_SUBSTEPS;
+            Vector3d a0 = (1 - s0) * acc[i] + s0 * acc[i + 1], a1 = (1 - s1) * acc[i] + s1 * acc[i + 1];
+            Vector3d g0 = (1 - s0) * gyr[i] + s0 * gyr[i + 1], g1 = (1 - s1) * gyr[i] + s1 * gyr[i + 1];
+            Vector3d p, v;
+            Quaterniond q;
+            RK4Integration::integrate(h, a0, g0, a1, g1, Vector3d::Zero(), Vector3d::Zero(),
+                                      w.delta_p, w.delta_q, w.delta_v, p, q, v);
+            w.delta_p = p;
+            w.delta_q = q;
+            w.delta_v = v;
+        }
+    }
+    return w;
+}
+
+template <typename Scheme>
+void evaluateScheme(const vector<double> &t, const vector<Vector3d> &acc, const vector<Vector3d> &gyr,
+                    const vector<pair<int, int>> &windows, const vector<Window> &reference, int decimation)
+{
+    ImuSampleArena arena;
+    double err_p = 0, err_v = 0, err_q = 0, cost = 0;
+    int num_samples = 0;
+    for (size_t w = 0; w < windows.size(); w++)
+    {
+        int begin = windows[w].first, end = windows[w].second;
+        IntegrationBaseT<Scheme> pre_integration(&arena, acc[begin], gyr[begin], Vector3d::Zero(), Vector3d::Zero());
+        vector<size_t> index;
+        for (int i = begin + decimation; i <= end; i += decimation)
+            index.push_back(arena.push_back(t[i] - t[i - decimation], acc[i], gyr[i]));
+        TicToc t_integrate;
+        for (size_t i = 0; i < index.size(); i++)
+            pre_integration.push_back(index[i]);
+        cost += t_integrate.toc();
+        num_samples += index.size();
+        arena.trim(arena.endIndex());
+
+        err_p += (pre_integration.delta_p - reference[w].delta_p).norm();
+        err_v += (pre_integration.delta_v - reference[w].delta_v).norm();
+        err_q += pre_integration.delta_q.angularDistance(reference[w].delta_q);
+    }
+    int n = windows.size();
+    printf("%-9s rate/%d  dp %.3e m  dv %.3e m/s  dq %.3e rad  %.3f us/sample\n", Scheme::name(), decimation,
+           err_p / n, err_v / n, err_q / n, cost * 1000.0 / max(num_samples, 1));
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "vins_estimator");
+
+    if (argc != 3 && argc != 4)
+    {
+        printf("please intput: rosrun vins imu_integration_test [config file] [imu csv] [window seconds] \n"
+               "for example: rosrun vins imu_integration_test "
+               "~/catkin_ws/src/VINS-Fusion/config/euroc/euroc_stereo_imu_config.yaml "
+               "/media/euroc/MH_01_easy/mav0/imu0/data.csv 0.5 \n");
+        return 1;
+    }
+    readParameters(argv[1]);
+    double window_length = argc == 4 ? atof(argv[3]) : 0.5;
+
+    // EuRoC格式：timestamp[ns], w_x, w_y, w_z, a_x, a_y, a_z
+    FILE *file = fopen(argv[2], "r");
+    if (file == NULL)
+    {
+        printf("cannot find file: %s\n", argv[2]);
+        return 1;
+    }
+    vector<double> t;
+    vector<Vector3d> acc, gyr;
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        if (line[0] == '#')
+            continue;
+        double stamp, wx, wy, wz, ax, ay, az;
+        if (sscanf(line, "%lf,%lf,%lf,%lf,%lf,%lf,%lf", &stamp, &wx, &wy, &wz, &ax, &ay, &az) != 7)
+            continue;
+        t.push_back(stamp * 1e-9);
+        gyr.push_back(Vector3d(wx, wy, wz));
+        acc.push_back(Vector3d(ax, ay, az));
+    }
+    fclose(file);
+    if (t.size() < 2)
+    {
+        printf("no imu data in %s\n", argv[2]);
+        return 1;
+    }
+    printf("%zu imu samples, %.1f Hz, window %.2f s\n", t.size(), (t.size() - 1) / (t.back() - t.front()), window_length);
+
+    // 窗口长度取为样本数，并保证能被最大降采样倍数整除
+    const int MAX_DECIMATION = 4;
+    int window_samples = max(1, int(window_length / ((t.back() - t.front()) / (t.size() - 1)) / MAX_DECIMATION)) * MAX_DECIMATION;
+    vector<pair<int, int>> windows;
+    vector<Window> reference;
+    for (int begin = 0; begin + window_samples < (int)t.size(); begin += window_samples)
+    {
+        windows.push_back(make_pair(begin, begin + window_samples));
+        reference.push_back(integrateReference(t, acc, gyr, begin, begin + window_samples));
+    }
+
+    for (int decimation = 1; decimation <= MAX_DECIMATION; decimation *= 2)
+    {
+        evaluateScheme<MidPointIntegration>(t, acc, gyr, windows, reference, decimation);
+        evaluateScheme<RK4Integration>(t, acc, gyr, windows, reference, decimation);
+        evaluateScheme<ManifoldIntegration>(t, acc, gyr, windows, reference, decimation);
+    }
+    return 0;
+}
@@ -0,0 +1,265 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <stdio.h>
+#include <vector>
+#include <random>
+#include <unordered_map>
+#include <ros/ros.h>
+#include "estimator/parameters.h"
+#include "factor/imu_factor.h"
+#include "factor/marginalization_factor.h"
+#include "factor/projectionTwoFrameOneCamFactor.h"
+#include "factor/projectionTwoFrameTwoCamFactor.h"
+#include "factor/projectionOneFrameTwoCamFactor.h"
+#include "utility/tic_toc.h"
+
+using namespace std;
+using namespace Eigen;
+
+/**边缘化耗时对比。
+ * 构造与Estimator::optimization中MARGIN_OLD相同结构的边缘化问题：上一次边缘化得到的先验、第0、1帧之间的IMU因子、
+ * 首次观测帧为第0帧的路标点的视觉因子；分别用MarginalizationInfo::marginalize()与特征值分解的方法（改为Cholesky之前的实现）求解，
+ * 比较耗时与得到的先验（J^T*J、J^T*r）
+**/
+
+struct Window
+{
+    double pose[WINDOW_SIZE + 1][SIZE_POSE];
+    double speed_bias[WINDOW_SIZE + 1][SIZE_SPEEDBIAS];
+    double ex_pose[2][SIZE_POSE];
+    double td[1];
+    vector<double> inv_depth;
+    Matrix3d R[WINDOW_SIZE + 1];
+    Vector3d P[WINDOW_SIZE + 1];
+    vector<Vector3d> points;  //路标点的世界坐标
+};
+
+void setPose(double *para, const Matrix3d &R, const Vector3d &P)
+{
+    Quaterniond q(R);
+    para[0] = P.x();
+    para[1] = P.y();
+    para[2] = P.z();
+    para[3] = q.x();
+    para[4] = q.y();
+    para[5] = q.z();
+    para[6] = q.w();
+}
+
+// 路标点在第frame帧第cam个相机归一化平面上的坐标
+Vector3d observe(const Window &w, int frame, int cam, int l, mt19937 &rng)
+{
+    normal_distribution<double> pixel_noise(0.0, 1.0 / FOCAL_LENGTH);
+    Vector3d pc = RIC[cam].transpose() * (w.R[frame].transpose() * (w.points[l] - w.P[frame]) - TIC[cam]);
+    return Vector3d(pc.x() / pc.z() + pixel_noise(rng), pc.y() / pc.z() + pixel_noise(rng), 1.0);
+}
+
+void buildWindow(Window &w, int num_landmarks, mt19937 &rng)
+{
+    uniform_real_distribution<double> unif(-1.0, 1.0);
+    for (int i = 0; i <= WINDOW_SIZE; i++)  //沿x方向运动并缓慢偏航，相机朝前
+    {
+        double t = 0.1 * i;
+        w.R[i] = Utility::ypr2R(Vector3d(5.0 * t, 0, 0));
+        w.P[i] = Vector3d(t, 0.1 * sin(t), 0);
+        setPose(w.pose[i], w.R[i], w.P[i]);
+        for (int k = 0; k < SIZE_SPEEDBIAS; k++)
+            w.speed_bias[i][k] = 0.01 * unif(rng);
+        w.speed_bias[i][0] = 1.0;
+    }
+    for (int c = 0; c < NUM_OF_CAM; c++)
+        setPose(w.ex_pose[c], RIC[c], TIC[c]);
+    w.td[0] = TD;
+
+    w.points.resize(num_landmarks);
+    w.inv_depth.resize(num_landmarks);
+    for (int l = 0; l < num_landmarks; l++)  //第0帧相机前方2~10m处
+    {
+        double depth = 2.0 + 4.0 * (unif(rng) + 1.0);
+        Vector3d pc(0.5 * unif(rng) * depth, 0.4 * unif(rng) * depth, depth);
+        w.points[l] = w.R[0] * (RIC[0] * pc + TIC[0]) + w.P[0];
+        w.inv_depth[l] = 1.0 / depth;
+    }
+}
+
+// 按Estimator::optimization中MARGIN_OLD的方式添加残差块；prior为空时不含先验
+MarginalizationInfo *buildMarginalization(Window &w, IntegrationBase *pre_integration, MarginalizationInfo *prior,
+                                          const vector<double *> &prior_blocks, ceres::LossFunction *loss_function,
+                                          ThreadPool *thread_pool, mt19937 &rng)
+{
+    MarginalizationInfo *marginalization_info = new MarginalizationInfo(thread_pool);
+
+    if (prior)
+    {
+        vector<int> drop_set;
+        for (int i = 0; i < static_cast<int>(prior_blocks.size()); i++)
+        {
+            if (prior_blocks[i] == w.pose[0] || prior_blocks[i] == w.speed_bias[0])
+                drop_set.push_back(i);
+        }
+        MarginalizationFactor *marginalization_factor = new MarginalizationFactor(prior);
+        marginalization_info->addResidualBlockInfo(new ResidualBlockInfo(marginalization_factor, NULL, prior_blocks, drop_set));
+    }
+
+    IMUFactor *imu_factor = new IMUFactor(pre_integration);
+    marginalization_info->addResidualBlockInfo(new ResidualBlockInfo(imu_factor, NULL,
+                                                                     vector<double *>{w.pose[0], w.speed_bias[0], w.pose[1], w.speed_bias[1]},
+                                                                     vector<int>{0, 1}));
+
+    Vector2d velocity = Vector2d::Zero();
+    for (int l = 0; l < (int)w.points.size(); l++)
+    {
+        int track_length = 4 + l % (WINDOW_SIZE - 2);  //与Estimator相同，仅有不少于4次观测的路标点参与边缘化
+        Vector3d pts_i = observe(w, 0, 0, l, rng);
+        for (int j = 0; j < track_length; j++)
+        {
+            if (j != 0)
+            {
+                ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, observe(w, j, 0, l, rng), velocity, velocity, TD, TD);
+                marginalization_info->addResidualBlockInfo(new ResidualBlockInfo(f_td, loss_function,
+                                                                                 vector<double *>{w.pose[0], w.pose[j], w.ex_pose[0], &w.inv_depth[l], w.td},
+                                                                                 vector<int>{0, 3}));
+            }
+            if (STEREO)
+            {
+                Vector3d pts_j_right = observe(w, j, 1, l, rng);
+                if (j != 0)
+                {
+                    ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, velocity, velocity, TD, TD);
+                    marginalization_info->addResidualBlockInfo(new ResidualBlockInfo(f, loss_function,
+                                                                                     vector<double *>{w.pose[0], w.pose[j], w.ex_pose[0], w.ex_pose[1], &w.inv_depth[l], w.td},
+                                                                                     vector<int>{0, 4}));
+                }
+                else
+                {
+                    ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, velocity, velocity, TD, TD);
+                    marginalization_info->addResidualBlockInfo(new ResidualBlockInfo(f, loss_function,
+                                                                                     vector<double *>{w.ex_pose[0], w.ex_pose[1], &w.inv_depth[l], w.td},
+                                                                                     vector<int>{2}));
+                }
+            }
+        }
+    }
+    return marginalization_info;
+}
+
+// 特征值分解的边缘化（改为Cholesky之前的实现）：稠密构建A、b，对Amm做特征值分解求伪逆，再对Schur补做特征值分解得到先验
+void marginalizeEigen(MarginalizationInfo *info, MatrixXd &linearized_jacobians, VectorXd &linearized_residuals)
+{
+    int m = info->m, n = info->n;
+    double eps = info->eps;
+    VectorXd Dll, bl, b;
+    MatrixXd Alo, A;
+    info->constructHessian(m + n, 0, Dll, bl, Alo, A, b);
+
+    MatrixXd Amm = 0.5 * (A.block(0, 0, m, m) + A.block(0, 0, m, m).transpose());
+    SelfAdjointEigenSolver<MatrixXd> saes(Amm);
+    MatrixXd Amm_inv = saes.eigenvectors() * VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() * saes.eigenvectors().transpose();
+    VectorXd bmm = b.segment(0, m);
+    MatrixXd Amr = A.block(0, m, m, n);
+    MatrixXd Arm = A.block(m, 0, n, m);
+    MatrixXd Arr = A.block(m, m, n, n);
+    VectorXd brr = b.segment(m, n);
+    A = Arr - Arm * Amm_inv * Amr;
+    b = brr - Arm * Amm_inv * bmm;
+
+    SelfAdjointEigenSolver<MatrixXd> saes2(A);
+    VectorXd S = VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array(), 0));
+    VectorXd S_inv = VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array().inverse(), 0));
+    linearized_jacobians = S.cwiseSqrt().asDiagonal() * saes2.eigenvectors().transpose();
+    linearized_residuals = S_inv.cwiseSqrt().asDiagonal() * saes2.eigenvectors().transpose() * b;
+}
+
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "vins_estimator");
+
+    if (argc < 2)
+    {
+        printf("please intput: rosrun vins marginalization_test [config file] [number of landmarks ...] \n"
+               "for example: rosrun vins marginalization_test "
+               "~/catkin_ws/src/VINS-Fusion/config/euroc/euroc_stereo_imu_config.yaml 100 300 1000 \n");
+        return 1;
+    }
+    readParameters(argv[1]);
+    vector<int> landmark_counts;
+    for (int i = 2; i < argc; i++)
+        landmark_counts.push_back(atoi(argv[i]));
+    if (landmark_counts.empty())
+        landmark_counts = {100, 300, 1000};
+
+    ProjectionTwoFrameOneCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
+    ProjectionTwoFrameTwoCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
+    ProjectionOneFrameTwoCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
+    ceres::HuberLoss loss_function(1.0);
+    ThreadPool thread_pool;
+    thread_pool.setNumThreads(BACKEND_THREADS);
+    printf("%s, %d backend threads\n", STEREO ? "stereo" : "mono", BACKEND_THREADS);
+
+    const int REPEAT = 3;
+    for (int num_landmarks : landmark_counts)
+    {
+        mt19937 rng(num_landmarks);
+        Window w;
+        buildWindow(w, num_landmarks, rng);
+
+        // 第0、1帧之间200Hz的IMU数据
+        ImuSampleArena arena;
+        normal_distribution<double> imu_noise(0.0, 0.05);
+        Vector3d acc(0.1, 0.0, 9.81), gyr(0.0, 0.0, 0.5);
+        IntegrationBase pre_integration(&arena, acc, gyr, Vector3d::Zero(), Vector3d::Zero());
+        for (int k = 0; k < 20; k++)
+            pre_integration.push_back(arena.push_back(0.005, acc + Vector3d(imu_noise(rng), imu_noise(rng), imu_noise(rng)), gyr));
+
+        // 先做一次不含先验的边缘化，按滑窗前移后的地址映射得到先验，与Estimator中连续两次MARGIN_OLD相同
+        MarginalizationInfo *prior = buildMarginalization(w, &pre_integration, NULL, vector<double *>(), &loss_function, &thread_pool, rng);
+        prior->preMarginalize();
+        prior->marginalize();
+        unordered_map<long, double *> addr_shift;
+        for (int i = 1; i <= WINDOW_SIZE; i++)
+        {
+            addr_shift[reinterpret_cast<long>(w.pose[i])] = w.pose[i - 1];
+            addr_shift[reinterpret_cast<long>(w.speed_bias[i])] = w.speed_bias[i - 1];
+        }
+        for (int c = 0; c < NUM_OF_CAM; c++)
+            addr_shift[reinterpret_cast<long>(w.ex_pose[c])] = w.ex_pose[c];
+        addr_shift[reinterpret_cast<long>(w.td)] = w.td;
+        vector<double *> prior_blocks = prior->getParameterBlocks(addr_shift);
+
+        MarginalizationInfo *info = buildMarginalization(w, &pre_integration, prior, prior_blocks, &loss_function, &thread_pool, rng);
+        double t_pre = 0, t_margin = 0, t_eigen = 0;
+        MatrixXd J_eigen;
+        VectorXd r_eigen;
+        for (int k = 0; k < REPEAT; k++)
+        {
+            TicToc t_pre_margin;
+            info->preMarginalize();
+            t_pre += t_pre_margin.toc();
+            TicToc t_marginalize;
+            info->marginalize();
+            t_margin += t_marginalize.toc();
+            TicToc t_eigen_margin;
+            marginalizeEigen(info, J_eigen, r_eigen);
+            t_eigen += t_eigen_margin.toc();
+        }
+
+        MatrixXd H = info->linearized_jacobians.transpose() * info->linearized_jacobians;
+        MatrixXd H_eigen = J_eigen.transpose() * J_eigen;
+        VectorXd g = info->linearized_jacobians.transpose() * info->linearized_residuals;
+        VectorXd g_eigen = J_eigen.transpose() * r_eigen;
+        printf("landmarks %5d  m %5d  n %4d  preMarginalize %8.3f ms  marginalize %8.3f ms  eigen %9.3f ms  prior diff H %.1e b %.1e\n",
+               num_landmarks, info->m, info->n, t_pre / REPEAT, t_margin / REPEAT, t_eigen / REPEAT,
+               (H - H_eigen).norm() / H_eigen.norm(), (g - g_eigen).norm() / max(g_eigen.norm(), 1e-12));
+
+        delete info;
+        delete prior;
+    }
+    return 0;
+}
@@ -14,6 +14,11 @@ Estimator::Estimator(): f_manager{Rs}
 {
     ROS_INFO("init begins");
     initThreadFlag = false;
+    latest_anchor_version = 0;
+    snapshot.valid = false;
+    snapshot.prior = nullptr;
+    for (int i = 0; i < WINDOW_SIZE + 1; i++)
+        snapshot.pre_integrations[i] = nullptr;
     clearState();
 }
 
@@ -51,14 +56,8 @@ void Estimator::clearState()
         Vs[i].setZero();
         Bas[i].setZero();
         Bgs[i].setZero();
-        dt_buf[i].clear();
-        linear_acceleration_buf[i].clear();
-        angular_velocity_buf[i].clear();
 
-        if (pre_integrations[i] != nullptr)
-        {
-            delete pre_integrations[i];
-        }
+        integration_pool.release(pre_integrations[i]);
         pre_integrations[i] = nullptr;
     }
 
@@ -74,10 +73,11 @@ void Estimator::clearState()
     frame_count = 0;
     solver_flag = INITIAL;
     initial_timestamp = 0;
-    all_image_frame.clear();
+    init_start_time = -1;
+    eraseImageFrames(all_image_frame.begin(), all_image_frame.end());
+    imu_arena.clear();
 
-    if (tmp_pre_integration != nullptr)
-        delete tmp_pre_integration;
+    integration_pool.release(tmp_pre_integration);
     if (last_marginalization_info != nullptr)
         delete last_marginalization_info;
 
@@ -86,12 +86,52 @@ void Estimator::clearState()
     last_marginalization_parameter_blocks.clear();
 
     f_manager.clearState();
+    local_map.clear();
+    releaseSnapshot();
 
     failure_occur = 0;
+    memset(reproj_histogram, 0, sizeof(reproj_histogram));
 
     mProcess.unlock();
 }
 
+void Estimator::eraseImageFrames(map<double, ImageFrame>::iterator first, map<double, ImageFrame>::iterator last)  //删除图像帧及其持有的预积分
+{
+    for (map<double, ImageFrame>::iterator it = first; it != last; it++)
+        integration_pool.release(it->second.pre_integration);
+    all_image_frame.erase(first, last);
+}
+
+/**限制all_image_frame的大小：初始化长时间未成功时，次新帧不断被边缘化，滑窗外的非关键帧会持续累积。
+ * 超出MAX_IMAGE_FRAMES时，将最老的滑窗外图像帧的预积分与其后一帧的预积分合并，然后删除该帧
+**/
+void Estimator::pruneImageFrames()
+{
+    while ((int)all_image_frame.size() > MAX_IMAGE_FRAMES)
+    {
+        map<double, ImageFrame>::iterator it = all_image_frame.begin();
+        for (it++; next(it) != all_image_frame.end(); it++)
+        {
+            bool in_window = false;
+            for (int i = 0; i <= frame_count && !in_window; i++)
+                in_window = Headers[i] == it->first;
+            if (!in_window)
+                break;
+        }
+        if (next(it) == all_image_frame.end())
+            break;
+
+        map<double, ImageFrame>::iterator it_next = next(it);
+        IntegrationBase *merged = it->second.pre_integration;
+        IntegrationBase *tail = it_next->second.pre_integration;
+        merged->extend(*tail);
+        integration_pool.release(tail);
+        it_next->second.pre_integration = merged;
+        it->second.pre_integration = nullptr;
+        all_image_frame.erase(it);
+    }
+}
+
 void Estimator::setParameter()
 {
     mProcess.lock();  // 锁mProcess主要用于processThread线程互斥安全
@@ -106,6 +146,15 @@ void Estimator::setParameter()
     ProjectionTwoFrameOneCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
     ProjectionTwoFrameTwoCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
     ProjectionOneFrameTwoCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
+    // 路标点参数块的容量预估：每个相机最多MAX_CNT个跟踪点
+    para_Feature.setChunkSize(max(MAX_CNT, 1));
+    para_Feature.reserve(MAX_CNT * NUM_OF_CAM);
+    thread_pool.setNumThreads(BACKEND_THREADS);
+    f_manager.setThreadPool(&thread_pool);
+    local_map.setParameters(LOCAL_MAP_VOXEL_SIZE, LOCAL_MAP_RADIUS);
+    f_manager.setLocalMap(LOCAL_MAP ? &local_map : nullptr);
+    integration_pool.reserve(3 * (WINDOW_SIZE + 1) + MAX_IMAGE_FRAMES + 1);
+    imu_arena.reserve(4096);  //滑窗、all_image_frame、tmp预积分与状态快照的上限
     td = TD;
     g = G;
     cout << "set g " << g.transpose() << endl;
@@ -210,12 +259,22 @@ void Estimator::inputIMU(double t, const Vector3d &linearAcceleration, const Vec
     //printf("input imu with time %f \n", t);
     mBuf.unlock();
 
+    // 以下数据仅由IMU回调线程访问，不与后端共享锁
+    propAccBuf.push_back(make_pair(t, linearAcceleration));
+    propGyrBuf.push_back(make_pair(t, angularVelocity));
+    while (propAccBuf.size() > 2000)  //后端长时间未发布新状态时限制缓存大小
+    {
+        propAccBuf.pop_front();
+        propGyrBuf.pop_front();
+    }
+
     if (solver_flag == NON_LINEAR)
     {
-        mPropagate.lock();
-        fastPredictIMU(t, linearAcceleration, angularVelocity);  //IMU 中值积分预测，计算最新p、v、q
+        if (latest_anchor.currentVersion() != latest_anchor_version)
+            repropagateLatestStates();  //后端有新的优化结果，从新起点开始重新传播
+        else
+            fastPredictIMU(t, linearAcceleration, angularVelocity);  //IMU 中值积分预测，计算最新p、v、q
         pubLatestOdometry(latest_P, latest_Q, latest_V, t);  // 发布中值积分预测的状态（最新数据），主要是p、v、q
-        mPropagate.unlock();
     }
 }
 
@@ -346,6 +405,7 @@ void Estimator::processMeasurements()  //传感器数据处理入口，也是多
             pubPointCloud(*this, header);
             pubKeyframe(*this);  //TODO(tzhang): 当MARGIN_OLD时，也即次新帧为关键帧; 将次新帧发布出去，但是前面关键帧判断条件较为宽松;可将关键帧选取更严格
             pubTF(*this, header);
+            pubReprojectionHistogram(*this);
             mProcess.unlock();
         }
 
@@ -397,10 +457,29 @@ void Estimator::initFirstPose(Eigen::Vector3d p, Eigen::Matrix3d r)
 
 因此当滑动窗口还没有满的时候，就要new出pre_integrations[frame_count]出来。或者当slidewindow的时候，会把pre_integrations[WINDOW_SIZE]delete掉。这时候，就需要new一个新的预积分出来。
 
-    dt_buff, linear_acceration_buf , angular_velocity_buf 三者都是frame_count里面的，即一个图像帧里面包含包含了这些东西。
+    IMU数据统一存放在imu_arena中，各帧的预积分只记录自己在arena中的下标区间。
 
 同时，通过IMU的这些数据，来更新三个状态量，Ps,Vs,Rs（这个是绝对坐标系下的位姿）。这时候不是用预积分，而是用正常普通的积分并且用上中值积分。 processIMU()已经完成，接着是processImage()。
  **/
+void Estimator::integrateIMU(size_t index)  //将arena中下标为index的IMU数据积分进frame_count帧的预积分，并更新该帧的状态
+{
+    const ImuSample &s = imu_arena[index];
+    pre_integrations[frame_count]->push_back(index);
+    if(solver_flag != NON_LINEAR)  //仅初始化阶段需要all_image_frame的预积分
+        tmp_pre_integration->push_back(index);
+
+    //计算对应绝对坐标系下的位置等
+    //Rs Ps Vs是frame_count这一个图像帧开始的预积分值,是在绝对坐标系下的.
+    int j = frame_count;  //中值积分，此处与预积分中的中值积分基本相似；但此处的中值积分是以世界坐标系为基准，即更新的Rs、Ps、Vs在世界坐标系下表达 tzhang
+    Vector3d un_acc_0 = Rs[j] * (acc_0 - Bas[j]) - g;  //移除了偏执的加速度
+    Vector3d un_gyr = 0.5 * (gyr_0 + s.gyr) - Bgs[j];  //移除了偏执的gyro
+    Rs[j] *= Utility::deltaQ(un_gyr * s.dt).toRotationMatrix();  //等式右侧对应dq，利用0.5*theta得到；左侧Rs[j]乘以dq更新旋转 tzhang
+    Vector3d un_acc_1 = Rs[j] * (s.acc - Bas[j]) - g;
+    Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
+    Ps[j] += s.dt * Vs[j] + 0.5 * s.dt * s.dt * un_acc;
+    Vs[j] += s.dt * un_acc;
+}
+
 void Estimator::processIMU(double t, double dt, const Vector3d &linear_acceleration, const Vector3d &angular_velocity)
 {
     if (!first_imu)  // 图像帧间的第一个imu数据
@@ -412,29 +491,13 @@ void Estimator::processIMU(double t, double dt, const Vector3d &linear_accelerat
 
     if (!pre_integrations[frame_count])  // 滑窗中之前不存在该预积分，然后新建； pre_integrations为存储预积分指针的数组
     {
-        pre_integrations[frame_count] = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]};
+        pre_integrations[frame_count] = integration_pool.acquire(acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]);
     }
     if (frame_count != 0)  //不是滑窗中的第一帧
     {
         //预积分。push_back进行了重载，
-        pre_integrations[frame_count]->push_back(dt, linear_acceleration, angular_velocity);
-        //if(solver_flag != NON_LINEAR)
-        tmp_pre_integration->push_back(dt, linear_acceleration, angular_velocity);
-
-        dt_buf[frame_count].push_back(dt);  //将图像帧之间的imu数据存储至 元素为vector的数组 tzhang
-        linear_acceleration_buf[frame_count].push_back(linear_acceleration);
-        angular_velocity_buf[frame_count].push_back(angular_velocity);
-
-        //计算对应绝对坐标系下的位置等
-        //Rs Ps Vs是frame_count这一个图像帧开始的预积分值,是在绝对坐标系下的.
-        int j = frame_count;  //中值积分，此处与预积分中的中值积分基本相似；但此处的中值积分是以世界坐标系为基准，即更新的Rs、Ps、Vs在世界坐标系下表达 tzhang
-        Vector3d un_acc_0 = Rs[j] * (acc_0 - Bas[j]) - g;  //移除了偏执的加速度
-        Vector3d un_gyr = 0.5 * (gyr_0 + angular_velocity) - Bgs[j];  //移除了偏执的gyro
-        Rs[j] *= Utility::deltaQ(un_gyr * dt).toRotationMatrix();  //等式右侧对应dq，利用0.5*theta得到；左侧Rs[j]乘以dq更新旋转 tzhang
-        Vector3d un_acc_1 = Rs[j] * (linear_acceleration - Bas[j]) - g;
-        Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
-        Ps[j] += dt * Vs[j] + 0.5 * dt * dt * un_acc;
-        Vs[j] += dt * un_acc;
+        size_t index = imu_arena.push_back(dt, linear_acceleration, angular_velocity);  //IMU数据只在arena中存一份 tzhang
+        integrateIMU(index);
     }  //此处的acc_0和gyr_0定义在estimator.h中,注意与integration_base.h中的区别；两处的作用都是为了存储之前的加速度和角速度，用于中值积分  tzhang
     acc_0 = linear_acceleration;
     gyr_0 = angular_velocity; 
@@ -474,7 +537,11 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     ROS_DEBUG("new image coming ------------------------------------------");
     ROS_DEBUG("Adding feature points %lu", image.size());
     // 检测关键帧
-    if (f_manager.addFeatureCheckParallax(frame_count, image, td))  //判定当前帧（frame_count）是否为关键帧 tzhang
+    Matrix3d delta_R;  //第frame_count-2帧到第frame_count-1帧的陀螺仪积分旋转，用于视差的旋转补偿
+    bool rot_comp = PARALLAX_ROT_COMP && USE_IMU && frame_count >= 2 && pre_integrations[frame_count - 1];
+    if (rot_comp)
+        delta_R = pre_integrations[frame_count - 1]->delta_q.toRotationMatrix();
+    if (f_manager.addFeatureCheckParallax(frame_count, image, td, rot_comp ? &delta_R : nullptr))  //判定当前帧（frame_count）是否为关键帧 tzhang
     {
         marginalization_flag = MARGIN_OLD;  //当前帧为关键帧，则边缘化窗口中最老的图像帧（新一帧将被作为关键帧!）
         //printf("keyframe\n");
@@ -489,11 +556,17 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     ROS_DEBUG("Solving %d", frame_count);
     ROS_DEBUG("number of feature: %d", f_manager.getFeatureCount());
     Headers[frame_count] = header;
+    if (init_start_time < 0)
+        init_start_time = header;
 
-    ImageFrame imageframe(image, header);  //特征点信息，图像帧时间戳构成当前图像帧信息 tzhang
-    imageframe.pre_integration = tmp_pre_integration;
-    all_image_frame.insert(make_pair(header, imageframe));
-    tmp_pre_integration = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]};  //tmp预积分重新新建初始化 tzhang
+    if (solver_flag == INITIAL)  //all_image_frame仅在初始化阶段使用
+    {
+        ImageFrame imageframe(image, header);  //特征点信息，图像帧时间戳构成当前图像帧信息 tzhang
+        imageframe.pre_integration = tmp_pre_integration;  //预积分的所有权转移给all_image_frame
+        all_image_frame.insert(make_pair(header, imageframe));
+        tmp_pre_integration = integration_pool.acquire(acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]);  //tmp预积分重新新建初始化 tzhang
+        pruneImageFrames();
+    }
 
     // 估计一个外部参,并把ESTIMATE_EXTRINSIC置1,输出ric和RIC
     if(ESTIMATE_EXTRINSIC == 2)  //2,说明估计相机与IMU之间的外参，且未给定外参初始值
@@ -540,7 +613,7 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
                     updateLatestStates();  //获取滑窗中最新帧时刻的状态，并在世界坐标系下进行中值积分；重要：初始化完成后，最新状态在inputIMU函数中发布
                     solver_flag = NON_LINEAR;
                     slideWindow(); //滑动窗口
-                    ROS_INFO("Initialization finish!");
+                    ROS_INFO("Initialization finish! %f s after the first frame", header - init_start_time);
                 }
                 else  //滑掉这一窗
                     slideWindow();  //初始化失败也需要进行滑窗处理。若global sfm求解引起的失败，则一律移除最老的图像帧；否则，根据addFeatureCheckParallax的判断，决定移除哪一帧
@@ -548,12 +621,15 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
         }
 
         // stereo + IMU initilization
-        //双目+imu，当帧数填满滑窗后，对IMU陀螺零偏进行了估计
+        //双目+imu：PnP位姿达到STEREO_INIT_FRAMES帧后，由双目位姿与预积分求解零偏、速度与重力，滑窗未满即可进入非线性优化
         if(STEREO && USE_IMU)  //双目+IMU版本的初始化
         {
-            f_manager.initFramePoseByPnP(frame_count, Ps, Rs, tic, ric);  //滑窗满之前，通过PnP求解图像帧之间的位姿，通过三角化初始化路标点（逆深度）tzhang
+            f_manager.initFramePoseByPnP(frame_count, Ps, Rs, tic, ric);  //通过PnP求解图像帧之间的位姿，通过三角化初始化路标点（逆深度）tzhang
             f_manager.triangulate(frame_count, Ps, Rs, tic, ric);   // 双目三角化
-            if (frame_count == WINDOW_SIZE)    //滑窗满后开始优化处理 tzhang
+            bool result = false;
+            if (frame_count + 1 >= STEREO_INIT_FRAMES)
+                result = stereoInertialAlign();
+            if (!result && frame_count == WINDOW_SIZE)  //对准失败时，滑窗满后仅估计陀螺零偏（速度为0）进入优化
             {
                 map<double, ImageFrame>::iterator frame_it;
                 int i = 0;
@@ -571,11 +647,15 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
                 {
                     pre_integrations[i]->repropagate(Vector3d::Zero(), Bgs[i]);
                 }
+                result = true;
+            }
+            if (result)
+            {
                 optimization();  //整个VIO的精华和难点
                 updateLatestStates();  // 让此时刻的值都等于上一时刻的值,用来更新状态
                 solver_flag = NON_LINEAR;
                 slideWindow();   // 滑动窗口法,就是把前后元素交换
-                ROS_INFO("Initialization finish!");
+                ROS_INFO("Initialization finish! %d frames, %f s after the first frame", frame_count + 1, header - init_start_time);
             }
         }
 
@@ -593,22 +673,21 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
                 updateLatestStates();
                 solver_flag = NON_LINEAR;
                 slideWindow();
-                ROS_INFO("Initialization finish!");
+                ROS_INFO("Initialization finish! %f s after the first frame", header - init_start_time);
             }
         }
 
-        if(frame_count < WINDOW_SIZE)  //滑窗未满，下一图像帧时刻的状态量用上一图像帧时刻的状态量进行初始化
-                                       //（PS：processIMU函数中，会对Ps、Vs、Rs用中值积分进行更新）
+        if (solver_flag == NON_LINEAR)  //初始化完成，释放all_image_frame
         {
-            frame_count++;
-            int prev_frame = frame_count - 1;
-            Ps[frame_count] = Ps[prev_frame];
-            Vs[frame_count] = Vs[prev_frame];
-            Rs[frame_count] = Rs[prev_frame];
-            Bas[frame_count] = Bas[prev_frame];
-            Bgs[frame_count] = Bgs[prev_frame];
+            eraseImageFrames(all_image_frame.begin(), all_image_frame.end());
+            last_R = Rs[frame_count];  //failureDetection与初始化完成时的位姿比较，不能沿用重启前的值
+            last_P = Ps[frame_count];
+            last_R0 = Rs[0];
+            last_P0 = Ps[0];
+            if (USE_IMU)  //各初始化路径中预积分重新传播的统计（含初始化失败的尝试）
+                ROS_DEBUG("preintegration repropagate: full %ld, first-order %ld",
+                          IntegrationBase::repropagateStats().full.load(), IntegrationBase::repropagateStats().corrected.load());
         }
-
     }
     else  //初始化成功，优化环节 tzhang
     {
@@ -628,9 +707,14 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
 
         ROS_DEBUG("solver costs: %fms", t_solve.toc());
 
-        if (failureDetection())  //默认直接返回false，具体判定失败的条件可根据具体场景修正
+        if (failureDetection())  //FAILURE_DETECTION关闭时直接返回false，具体判定失败的条件可根据具体场景修正
         {
             ROS_WARN("failure detection!");
+            if (restoreSnapshot(header))  //优先回滚到最近一次正常状态的快照
+            {
+                ROS_WARN("system rolled back to snapshot!");
+                return;
+            }
             failure_occur = 1;
             clearState();  //清除状态、重新设置参数，相当于重新开启vio
             setParameter();
@@ -642,18 +726,33 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
         f_manager.removeFailures();  //进行故障检测.
         // prepare output of VINS
         key_poses.clear();
-        for (int i = 0; i <= WINDOW_SIZE; i++)
+        for (int i = 0; i <= frame_count; i++)
             key_poses.push_back(Ps[i]);
 
         //滑窗里面最新的位姿
-        last_R = Rs[WINDOW_SIZE];
-        last_P = Ps[WINDOW_SIZE];
+        last_R = Rs[frame_count];
+        last_P = Ps[frame_count];
         
         //滑窗里面最旧的位姿
         last_R0 = Rs[0];
         last_P0 = Ps[0];
         updateLatestStates();  //基于中值积分，计算更新位姿
+
+        if (SNAPSHOT_INTERVAL > 0 && frame_count == WINDOW_SIZE && ++frames_since_snapshot >= SNAPSHOT_INTERVAL)
+            saveSnapshot();
     }  
+
+    if(frame_count < WINDOW_SIZE)  //滑窗未满（初始化阶段，或双目+IMU提前完成初始化），下一图像帧时刻的状态量用上一图像帧时刻的状态量进行初始化
+                                   //（PS：processIMU函数中，会对Ps、Vs、Rs用中值积分进行更新）
+    {
+        frame_count++;
+        int prev_frame = frame_count - 1;
+        Ps[frame_count] = Ps[prev_frame];
+        Vs[frame_count] = Vs[prev_frame];
+        Rs[frame_count] = Rs[prev_frame];
+        Bas[frame_count] = Bas[prev_frame];
+        Bgs[frame_count] = Bgs[prev_frame];
+    }
 }
 
 
@@ -710,7 +809,7 @@ bool Estimator::initialStructure()
         for (auto &it_per_frame : it_per_id.feature_per_frame)  //对观测到路标点j的所有图像帧进行遍历
         {
             imu_j++;
-            Vector3d pts_j = it_per_frame.point;
+            Vector3d pts_j = it_per_frame.point();
             tmp_feature.observation.push_back(make_pair(imu_j, Eigen::Vector2d{pts_j.x(), pts_j.y()}));  //构建路标点在左相机图像坐标系下的观测（去畸变）
         }
         sfm_f.push_back(tmp_feature);
@@ -723,7 +822,7 @@ bool Estimator::initialStructure()
         ROS_INFO("Not enough features or parallax; Move device around");
         return false;
     }
-    GlobalSFM sfm;  // 通过global sfm求取滑窗中的图像帧位姿，以及观测到的路标点的位置
+    GlobalSFM sfm(&thread_pool);  // 通过global sfm求取滑窗中的图像帧位姿，以及观测到的路标点的位置
     if(!sfm.construct(frame_count + 1, Q, T, l,  //只有frame_count == WINDOW_SIZE才会调用initialStructure，此时frame_count即为WINDOW_SIZE
               relative_R, relative_T,
               sfm_f, sfm_tracked_points))
@@ -881,35 +980,87 @@ bool Estimator::visualInitialAlign()
     return true;
 }
 
+bool Estimator::stereoInertialAlign()  //双目+IMU初始化：滑窗中的位姿由PnP得到，尺度已知；求解陀螺与加速度计零偏、速度与重力，并将世界坐标系z轴对齐重力
+{
+    if ((int)all_image_frame.size() != frame_count + 1)  //all_image_frame须与滑窗中的图像帧一一对应
+        return false;
+    TicToc t_g;
+    map<double, ImageFrame>::iterator frame_it;
+    int i = 0;
+    for (frame_it = all_image_frame.begin(); frame_it != all_image_frame.end(); frame_it++, i++)
+    {
+        frame_it->second.R = Rs[i];
+        frame_it->second.T = Ps[i];
+    }
+    VectorXd x;
+    Vector3d g_w;  //PnP世界坐标系下的重力向量
+    if (!StereoInertialAlignment(all_image_frame, Bgs, Bas, g_w, x))
+    {
+        ROS_DEBUG("stereo inertial alignment failed!");
+        return false;
+    }
+
+    for (int i = 0; i <= frame_count; i++)
+    {
+        pre_integrations[i]->repropagate(Bas[i], Bgs[i]);
+        Vs[i] = Rs[i] * x.segment<3>(i * 3);  //速度由IMU坐标系转到世界坐标系
+    }
+
+    Matrix3d R0 = Utility::g2R(g_w);  //与visualInitialAlign相同，仅将世界坐标系的z向与重力方向对齐，不改变yaw
+    double yaw = Utility::R2ypr(R0 * Rs[0]).x();
+    R0 = Utility::ypr2R(Eigen::Vector3d{-yaw, 0, 0}) * R0;
+    g = R0 * g_w;
+    for (int i = 0; i <= frame_count; i++)
+    {
+        Ps[i] = R0 * Ps[i];
+        Rs[i] = R0 * Rs[i];
+        Vs[i] = R0 * Vs[i];
+    }
+    ROS_DEBUG_STREAM("g0     " << g.transpose());
+    ROS_DEBUG("stereo inertial alignment with %d frames costs %fms", frame_count + 1, t_g.toc());
+    return true;
+}
+
 bool Estimator::relativePose(Matrix3d &relative_R, Vector3d &relative_T, int &l)  //返回值：WINDOW_SIZE变换到l的旋转、平移；及图像帧index
 {
     // find previous frame which contians enough correspondance and parallex with newest frame
-    for (int i = 0; i < WINDOW_SIZE; i++)  //遍历滑窗中的图像帧（除去最后一个图像帧WINDOW_SIZE）
+    // 各线程按编号从小到大领取候选帧并行求解，已有成功的帧时跳过编号更大的候选帧；最终仍选取编号最小的成功帧，与串行遍历一致
+    std::atomic<int> next_candidate(0), best(WINDOW_SIZE);
+    Matrix3d candidate_R[WINDOW_SIZE];
+    Vector3d candidate_T[WINDOW_SIZE];
+    double candidate_parallax[WINDOW_SIZE];
+    thread_pool.parallelFor(thread_pool.numThreads(), [&](int, int, int)
     {
-        vector<pair<Vector3d, Vector3d>> corres;
-        corres = f_manager.getCorresponding(i, WINDOW_SIZE);  //获取图像帧i与最后一个图像帧（WINDOW_SIZE）共视路标点在各自左归一化相机坐标系的坐标
-        if (corres.size() > 20)  //图像帧i与最后一个图像帧之间的共视点数目大于20个才进行后续处理
+        for (int i = next_candidate++; i < best.load(); i = next_candidate++)  //遍历滑窗中的图像帧（除去最后一个图像帧WINDOW_SIZE）
         {
+            vector<pair<Vector3d, Vector3d>> corres;
+            corres = f_manager.getCorresponding(i, WINDOW_SIZE);  //获取图像帧i与最后一个图像帧（WINDOW_SIZE）共视路标点在各自左归一化相机坐标系的坐标
+            if (corres.size() <= 20)  //图像帧i与最后一个图像帧之间的共视点数目大于20个才进行后续处理
+                continue;
             double sum_parallax = 0;
-            double average_parallax;
             for (int j = 0; j < int(corres.size()); j++)
             {
                 Vector2d pts_0(corres[j].first(0), corres[j].first(1));
                 Vector2d pts_1(corres[j].second(0), corres[j].second(1));
                 double parallax = (pts_0 - pts_1).norm();
                 sum_parallax = sum_parallax + parallax;  //计算归一化相机坐标系下的视差和
-
             }
-            average_parallax = 1.0 * sum_parallax / int(corres.size());  //归一化相机坐标系下的平均视差
-            if(average_parallax * 460 > 30 && m_estimator.solveRelativeRT(corres, relative_R, relative_T))
+            candidate_parallax[i] = 1.0 * sum_parallax / int(corres.size());  //归一化相机坐标系下的平均视差
+            if(candidate_parallax[i] * 460 > 30 && m_estimator.solveRelativeRT(corres, candidate_R[i], candidate_T[i]))
             {  //上述的460表示焦距f（尽管并不太严谨，具体相机焦距并不一定是460），从而在图像坐标系下评估视差
-                l = i;
-                ROS_DEBUG("average_parallax %f choose l %d and newest frame to triangulate the whole structure", average_parallax * 460, l);
-                return true;
+                int cur_best = best.load();
+                while (i < cur_best && !best.compare_exchange_weak(cur_best, i))
+                    ;
             }
         }
-    }
-    return false;
+    });
+    if (best.load() >= WINDOW_SIZE)
+        return false;
+    l = best.load();
+    relative_R = candidate_R[l];
+    relative_T = candidate_T[l];
+    ROS_DEBUG("average_parallax %f choose l %d and newest frame to triangulate the whole structure", candidate_parallax[l] * 460, l);
+    return true;
 }
 
 void Estimator::vector2double()
@@ -955,7 +1106,8 @@ void Estimator::vector2double()
 
 
     VectorXd dep = f_manager.getDepthVector();
-    for (int i = 0; i < f_manager.getFeatureCount(); i++)
+    para_Feature.resize(dep.size());
+    for (int i = 0; i < dep.size(); i++)
         para_Feature[i][0] = dep(i);
 
     para_Td[0][0] = td;
@@ -1040,7 +1192,7 @@ void Estimator::double2vector()
     }
 
     VectorXd dep = f_manager.getDepthVector();
-    for (int i = 0; i < f_manager.getFeatureCount(); i++)
+    for (int i = 0; i < dep.size(); i++)
         dep(i) = para_Feature[i][0];
     f_manager.setDepth(dep);
 
@@ -1051,20 +1203,21 @@ void Estimator::double2vector()
 
 bool Estimator::failureDetection()
 {
-    return false;  //TODO(tzhang):失败检测策略还可自己探索
+    if (!FAILURE_DETECTION)  //TODO(tzhang):失败检测策略还可自己探索
+        return false;
     if (f_manager.last_track_num < 2)
     {
         ROS_INFO(" little feature %d", f_manager.last_track_num);
         //return true;
     }
-    if (Bas[WINDOW_SIZE].norm() > 2.5)
+    if (Bas[frame_count].norm() > 2.5)
     {
-        ROS_INFO(" big IMU acc bias estimation %f", Bas[WINDOW_SIZE].norm());
+        ROS_INFO(" big IMU acc bias estimation %f", Bas[frame_count].norm());
         return true;
     }
-    if (Bgs[WINDOW_SIZE].norm() > 1.0)
+    if (Bgs[frame_count].norm() > 1.0)
     {
-        ROS_INFO(" big IMU gyr bias estimation %f", Bgs[WINDOW_SIZE].norm());
+        ROS_INFO(" big IMU gyr bias estimation %f", Bgs[frame_count].norm());
         return true;
     }
     /*
@@ -1074,18 +1227,18 @@ bool Estimator::failureDetection()
         return true;
     }
     */
-    Vector3d tmp_P = Ps[WINDOW_SIZE];
+    Vector3d tmp_P = Ps[frame_count];
     if ((tmp_P - last_P).norm() > 5)
     {
-        //ROS_INFO(" big translation");
-        //return true;
+        ROS_INFO(" big translation");
+        return true;
     }
     if (abs(tmp_P.z() - last_P.z()) > 1)
     {
-        //ROS_INFO(" big z translation");
-        //return true; 
+        ROS_INFO(" big z translation");
+        return true; 
     }
-    Matrix3d tmp_R = Rs[WINDOW_SIZE];
+    Matrix3d tmp_R = Rs[frame_count];
     Matrix3d delta_R = tmp_R.transpose() * last_R;
     Quaterniond delta_Q(delta_R);
     double delta_angle;
@@ -1211,16 +1364,16 @@ void Estimator::optimization()
         // imu_i该特征点第一次被观测到的帧 ,imu_j = imu_i - 1
         int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
         
-        Vector3d pts_i = it_per_id.feature_per_frame[0].point;  //用于计算估计值
+        Vector3d pts_i = it_per_id.feature_per_frame[0].point();  //用于计算估计值
 
         for (auto &it_per_frame : it_per_id.feature_per_frame)  //遍历观测到路标点的图像帧
         {
             imu_j++;
             if (imu_i != imu_j) //既,本次不是第一次观测到
             {
-                Vector3d pts_j = it_per_frame.point;  //测量值
+                Vector3d pts_j = it_per_frame.point();  //测量值
                 //左相机在i时刻和j时刻分别观测到路标点
-                ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
+                ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity(), it_per_frame.velocity(),
                                                                  it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
                 problem.AddResidualBlock(f_td, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]);
                 
@@ -1233,16 +1386,16 @@ void Estimator::optimization()
             // 如果是双目的
             if(STEREO && it_per_frame.is_stereo)
             {                
-                Vector3d pts_j_right = it_per_frame.pointRight;
+                Vector3d pts_j_right = it_per_frame.pointRight();
                 if(imu_i != imu_j)  //既,本次不是第一次观测到
                 {   //左相机在i时刻、右相机在j时刻分别观测到路标点
-                    ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
+                    ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity(), it_per_frame.velocityRight(),
                                                                  it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
                     problem.AddResidualBlock(f, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
                 }
                 else //既,本次是第一次观测到
                 {   //左相机和右相机在i时刻分别观测到路标点
-                    ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
+                    ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity(), it_per_frame.velocityRight(),
                                                                  it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
                     problem.AddResidualBlock(f, loss_function, para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
                 }
@@ -1288,7 +1441,7 @@ void Estimator::optimization()
     //如果需要marg掉最老的一帧
     if (marginalization_flag == MARGIN_OLD)   //将最老的图像帧数据边缘化； tzhang
     {
-        MarginalizationInfo *marginalization_info = new MarginalizationInfo();//先验信息
+        MarginalizationInfo *marginalization_info = new MarginalizationInfo(&thread_pool);//先验信息
         vector2double();  //状态向量转存为数组形式
 
         // 先验部分，基于先验残差，边缘化滑窗中第0帧时刻的状态向量
@@ -1352,16 +1505,16 @@ void Estimator::optimization()
                                  //如果第一个观察帧不是第一帧就不进行考虑，因此后面用来构建marg矩阵的都是和第一帧有共视关系的滑窗帧
                     continue;
 
-                Vector3d pts_i = it_per_id.feature_per_frame[0].point;
+                Vector3d pts_i = it_per_id.feature_per_frame[0].point();
 
                 for (auto &it_per_frame : it_per_id.feature_per_frame)  //对观测到路标点的图像帧的遍历
                 {
                     imu_j++;
                     if(imu_i != imu_j)
                     {
-                        Vector3d pts_j = it_per_frame.point;
+                        Vector3d pts_j = it_per_frame.point();
                         //左相机在i时刻、在j时刻分别观测到路标点
-                        ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
+                        ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity(), it_per_frame.velocity(),
                                                                           it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
                         ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f_td, loss_function,
                                                                                         vector<double *>{para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]},//优化变量
@@ -1370,11 +1523,11 @@ void Estimator::optimization()
                     }
                     if(STEREO && it_per_frame.is_stereo)
                     {
-                        Vector3d pts_j_right = it_per_frame.pointRight;
+                        Vector3d pts_j_right = it_per_frame.pointRight();
                         if(imu_i != imu_j)
                         {
                             //左相机在i时刻、右相机在j时刻分别观测到路标点
-                            ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
+                            ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity(), it_per_frame.velocityRight(),
                                                                           it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
                             ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f, loss_function,
                                                                                            vector<double *>{para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]},//优化变量
@@ -1385,7 +1538,7 @@ void Estimator::optimization()
                         else
                         {
                             //左相机在i时刻、右相机在i时刻分别观测到路标点
-                            ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
+                            ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity(), it_per_frame.velocityRight(),
                                                                           it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
                             ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f, loss_function,
                                                                                            vector<double *>{para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]},
@@ -1440,7 +1593,7 @@ void Estimator::optimization()
             std::count(std::begin(last_marginalization_parameter_blocks), std::end(last_marginalization_parameter_blocks), para_Pose[WINDOW_SIZE - 1]))
         {
 
-            MarginalizationInfo *marginalization_info = new MarginalizationInfo();
+            MarginalizationInfo *marginalization_info = new MarginalizationInfo(&thread_pool);
             vector2double();
             if (last_marginalization_info && last_marginalization_info->valid)
             {
@@ -1462,7 +1615,7 @@ void Estimator::optimization()
 
             TicToc t_pre_margin;
             ROS_DEBUG("begin marginalization");
-            marginalization_info->preMarginalize();  //构建parameter_block_data
+            marginalization_info->preMarginalize();  //拷贝参数块数据到block_data
             ROS_DEBUG("end pre marginalization, %f ms", t_pre_margin.toc());
 
             TicToc t_margin;
@@ -1531,10 +1684,6 @@ void Estimator::slideWindow()
                 {
                     std::swap(pre_integrations[i], pre_integrations[i + 1]);
 
-                    dt_buf[i].swap(dt_buf[i + 1]);
-                    linear_acceleration_buf[i].swap(linear_acceleration_buf[i + 1]);
-                    angular_velocity_buf[i].swap(angular_velocity_buf[i + 1]);
-
                     Vs[i].swap(Vs[i + 1]);
                     Bas[i].swap(Bas[i + 1]);
                     Bgs[i].swap(Bgs[i + 1]);
@@ -1552,20 +1701,16 @@ void Estimator::slideWindow()
                 Bas[WINDOW_SIZE] = Bas[WINDOW_SIZE - 1];
                 Bgs[WINDOW_SIZE] = Bgs[WINDOW_SIZE - 1];
 
-                delete pre_integrations[WINDOW_SIZE];
-                pre_integrations[WINDOW_SIZE] = new IntegrationBase{acc_0, gyr_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]};
-
-                dt_buf[WINDOW_SIZE].clear();
-                linear_acceleration_buf[WINDOW_SIZE].clear();
-                angular_velocity_buf[WINDOW_SIZE].clear();
+                integration_pool.release(pre_integrations[WINDOW_SIZE]);
+                pre_integrations[WINDOW_SIZE] = integration_pool.acquire(acc_0, gyr_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]);
             }
             //3、对时刻t_0(对应滑窗第0帧)之前的所有数据进行剔除；即all_image_frame中仅保留滑窗中图像帧0与图像帧WINDOW_SIZE之间的数据
-            if (true || solver_flag == INITIAL)
+            map<double, ImageFrame>::iterator it_0 = all_image_frame.find(t_0);
+            if (it_0 != all_image_frame.end())
             {
-                map<double, ImageFrame>::iterator it_0;
-                it_0 = all_image_frame.find(t_0);
-                delete it_0->second.pre_integration;
-                all_image_frame.erase(all_image_frame.begin(), it_0);
+                eraseImageFrames(all_image_frame.begin(), it_0);
+                integration_pool.release(it_0->second.pre_integration);  //滑窗第0帧之前的预积分不再使用
+                it_0->second.pre_integration = nullptr;
             }
             slideWindowOld();
         }
@@ -1580,33 +1725,179 @@ void Estimator::slideWindow()
 
             if(USE_IMU)  //IMU数据衔接，预积分的传播
             {
-                for (unsigned int i = 0; i < dt_buf[frame_count].size(); i++)
-                {
-                    double tmp_dt = dt_buf[frame_count][i];
-                    Vector3d tmp_linear_acceleration = linear_acceleration_buf[frame_count][i];
-                    Vector3d tmp_angular_velocity = angular_velocity_buf[frame_count][i];
-
-                    pre_integrations[frame_count - 1]->push_back(tmp_dt, tmp_linear_acceleration, tmp_angular_velocity);  //预积分的传播
-
-                    dt_buf[frame_count - 1].push_back(tmp_dt);  //TODO(tzhang): 数据保存有冗余，integration_base中也保存了同样的数据
-                    linear_acceleration_buf[frame_count - 1].push_back(tmp_linear_acceleration);
-                    angular_velocity_buf[frame_count - 1].push_back(tmp_angular_velocity);
-                }
+                pre_integrations[frame_count - 1]->extend(*pre_integrations[frame_count]);  //预积分的传播，两段下标区间相邻，数据无需拷贝
 
                 Vs[frame_count - 1] = Vs[frame_count];
                 Bas[frame_count - 1] = Bas[frame_count];
                 Bgs[frame_count - 1] = Bgs[frame_count];
 
-                delete pre_integrations[WINDOW_SIZE];
-                pre_integrations[WINDOW_SIZE] = new IntegrationBase{acc_0, gyr_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]};
-
-                dt_buf[WINDOW_SIZE].clear();
-                linear_acceleration_buf[WINDOW_SIZE].clear();
-                angular_velocity_buf[WINDOW_SIZE].clear();
+                integration_pool.release(pre_integrations[WINDOW_SIZE]);
+                pre_integrations[WINDOW_SIZE] = integration_pool.acquire(acc_0, gyr_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]);
             }
             slideWindowNew();  //更新第一次观测到路标点的图像帧的索引
         }
     }
+    trimImuArena();
+}
+
+void Estimator::trimImuArena()  //arena中早于所有在用预积分的IMU数据不再需要
+{
+    size_t first_live = imu_arena.endIndex();
+    for (int i = 0; i <= frame_count && i <= WINDOW_SIZE; i++)
+    {
+        if (pre_integrations[i] != nullptr && pre_integrations[i]->numSamples() > 0)
+            first_live = min(first_live, pre_integrations[i]->sample_begin);
+    }
+    for (map<double, ImageFrame>::iterator it = all_image_frame.begin(); it != all_image_frame.end(); it++)
+    {
+        if (it->second.pre_integration != nullptr && it->second.pre_integration->numSamples() > 0)
+            first_live = min(first_live, it->second.pre_integration->sample_begin);
+    }
+    if (tmp_pre_integration != nullptr && tmp_pre_integration->numSamples() > 0)
+        first_live = min(first_live, tmp_pre_integration->sample_begin);
+    if (snapshot.valid && USE_IMU)  //快照之后的IMU数据在回滚时需要重新积分
+        first_live = min(first_live, snapshot.imu_end);
+    imu_arena.trim(first_live);
+}
+
+void Estimator::saveSnapshot()  //在failureDetection通过、滑窗移动之后调用，此时滑窗处于等待下一图像帧的状态
+{
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+    {
+        snapshot.Headers[i] = Headers[i];
+        snapshot.Ps[i] = Ps[i];
+        snapshot.Vs[i] = Vs[i];
+        snapshot.Rs[i] = Rs[i];
+        snapshot.Bas[i] = Bas[i];
+        snapshot.Bgs[i] = Bgs[i];
+    }
+    for (int i = 0; i < NUM_OF_CAM; i++)
+    {
+        snapshot.ric[i] = ric[i];
+        snapshot.tic[i] = tic[i];
+    }
+    snapshot.td = td;
+    snapshot.acc_0 = acc_0;
+    snapshot.gyr_0 = gyr_0;
+    snapshot.last_R = last_R;
+    snapshot.last_R0 = last_R0;
+    snapshot.last_P = last_P;
+    snapshot.last_P0 = last_P0;
+    if (USE_IMU)
+    {
+        snapshot.imu_begin = imu_arena.endIndex();
+        for (int i = 0; i <= WINDOW_SIZE; i++)
+        {
+            ROS_ASSERT(pre_integrations[i] != nullptr);
+            if (snapshot.pre_integrations[i] == nullptr)
+                snapshot.pre_integrations[i] = integration_pool.acquire(acc_0, gyr_0, Bas[i], Bgs[i]);
+            *snapshot.pre_integrations[i] = *pre_integrations[i];
+            if (pre_integrations[i]->numSamples() > 0)
+                snapshot.imu_begin = min(snapshot.imu_begin, pre_integrations[i]->sample_begin);
+        }
+        snapshot.imu_end = imu_arena.endIndex();
+        snapshot.imu_samples.clear();
+        for (size_t k = snapshot.imu_begin; k < snapshot.imu_end; k++)
+            snapshot.imu_samples.push_back(imu_arena[k]);
+    }
+    f_manager.saveState(snapshot.features);
+    delete snapshot.prior;
+    snapshot.prior = last_marginalization_info ? last_marginalization_info->clonePrior() : nullptr;
+    snapshot.prior_parameter_blocks = last_marginalization_parameter_blocks;  //指向para_*成员，地址不变
+    snapshot.valid = true;
+    frames_since_snapshot = 0;
+}
+
+/**回滚到快照：恢复滑窗状态、预积分、路标点与边缘化先验。快照中的IMU数据重新写入arena，
+ * 快照之后到达的IMU数据重新积分到最新帧，使最新帧的状态对应当前图像帧时刻header。快照不可用时返回false
+**/
+bool Estimator::restoreSnapshot(double header)
+{
+    if (!snapshot.valid)
+        return false;
+    if (USE_IMU && imu_arena.beginIndex() > snapshot.imu_end)  //快照之后的IMU数据已被丢弃，无法补齐
+        return false;
+    TicToc t_restore;
+    vector<ImuSample> replay;  //快照之后到达的IMU数据
+    if (USE_IMU)
+    {
+        for (size_t k = snapshot.imu_end; k < imu_arena.endIndex(); k++)
+            replay.push_back(imu_arena[k]);
+    }
+
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+    {
+        Headers[i] = snapshot.Headers[i];
+        Ps[i] = snapshot.Ps[i];
+        Vs[i] = snapshot.Vs[i];
+        Rs[i] = snapshot.Rs[i];
+        Bas[i] = snapshot.Bas[i];
+        Bgs[i] = snapshot.Bgs[i];
+    }
+    for (int i = 0; i < NUM_OF_CAM; i++)
+    {
+        ric[i] = snapshot.ric[i];
+        tic[i] = snapshot.tic[i];
+    }
+    f_manager.setRic(ric);
+    td = snapshot.td;
+    acc_0 = snapshot.acc_0;
+    gyr_0 = snapshot.gyr_0;
+    last_R = snapshot.last_R;
+    last_R0 = snapshot.last_R0;
+    last_P = snapshot.last_P;
+    last_P0 = snapshot.last_P0;
+    frame_count = WINDOW_SIZE;
+
+    f_manager.restoreState(snapshot.features);
+    local_map.clear();  //快照之后加入的地图点来自故障前的估计，不再可信
+
+    if (last_marginalization_info != nullptr)
+        delete last_marginalization_info;
+    last_marginalization_info = snapshot.prior ? snapshot.prior->clonePrior() : nullptr;
+    last_marginalization_parameter_blocks = snapshot.prior_parameter_blocks;
+
+    if (USE_IMU)
+    {
+        imu_arena.clear();
+        size_t shift = imu_arena.endIndex() - snapshot.imu_begin;  //快照中的IMU数据在arena中的新下标 = 原下标 + shift
+        for (const ImuSample &s : snapshot.imu_samples)
+            imu_arena.push_back(s.dt, s.acc, s.gyr);
+        for (int i = 0; i <= WINDOW_SIZE; i++)
+        {
+            *pre_integrations[i] = *snapshot.pre_integrations[i];
+            if (pre_integrations[i]->numSamples() > 0)
+            {
+                pre_integrations[i]->sample_begin += shift;
+                pre_integrations[i]->sample_end += shift;
+            }
+        }
+        for (const ImuSample &s : replay)
+        {
+            integrateIMU(imu_arena.push_back(s.dt, s.acc, s.gyr));
+            acc_0 = s.acc;
+            gyr_0 = s.gyr;
+        }
+        Headers[WINDOW_SIZE] = header;
+    }
+    updateLatestStates();
+    snapshot.valid = false;  //同一快照只回滚一次，回滚后再次失败则重新初始化
+    ROS_WARN("restore snapshot costs %fms", t_restore.toc());
+    return true;
+}
+
+void Estimator::releaseSnapshot()
+{
+    for (int i = 0; i < WINDOW_SIZE + 1; i++)
+    {
+        integration_pool.release(snapshot.pre_integrations[i]);
+        snapshot.pre_integrations[i] = nullptr;
+    }
+    delete snapshot.prior;
+    snapshot.prior = nullptr;
+    snapshot.imu_samples.clear();
+    snapshot.valid = false;
+    frames_since_snapshot = 0;
 }
 
 void Estimator::slideWindowNew()
@@ -1671,7 +1962,7 @@ void Estimator::predictPtsInNextFrame()
             if((int)it_per_id.feature_per_frame.size() >= 2 && lastIndex == frame_count)  //仅对观测次数不小于两次、且在最新图像帧中观测到的路标点进行预测
             {
                 double depth = it_per_id.estimated_depth;  //逆深度，在start_frame图像帧中表示
-                Vector3d pts_j = ric[0] * (depth * it_per_id.feature_per_frame[0].point) + tic[0];  //路标点在start_frame图像帧时刻，相机坐标系下的坐标
+                Vector3d pts_j = ric[0] * (depth * it_per_id.feature_per_frame[0].point()) + tic[0];  //路标点在start_frame图像帧时刻，相机坐标系下的坐标
                 Vector3d pts_w = Rs[firstIndex] * pts_j + Ps[firstIndex];  //路标点在世界坐标系下的坐标
                 Vector3d pts_local = nextT.block<3, 3>(0, 0).transpose() * (pts_w - nextT.block<3, 1>(0, 3));  //路标在在下一时刻（预测的）体坐标系下坐标
                 Vector3d pts_cam = ric[0].transpose() * (pts_local - tic[0]);  ////路标在在下一时刻（预测的）相机坐标系下坐标
@@ -1699,60 +1990,77 @@ double Estimator::reprojectionError(Matrix3d &Ri, Vector3d &Pi, Matrix3d &rici,
 void Estimator::outliersRejection(set<int> &removeIndex)
 {
     //return;
-    int feature_index = -1;
+    // 预先计算滑窗内各帧左右相机在世界系下的位姿，避免对每个观测重复计算
+    Matrix3d R_wc[2][WINDOW_SIZE + 1];
+    Vector3d t_wc[2][WINDOW_SIZE + 1];
+    for (int i = 0; i <= frame_count; i++)
+    {
+        for (int c = 0; c < NUM_OF_CAM; c++)
+        {
+            R_wc[c][i] = Rs[i] * ric[c];
+            t_wc[c][i] = Rs[i] * tic[c] + Ps[i];
+        }
+    }
+
+    // 将所有参与判断的观测展平为一个数组，便于均匀地分配给各线程
+    struct Observation
+    {
+        int landmark;
+        int frame;
+        int cam;
+        const FeaturePerFrame *per_frame;
+    };
+    vector<FeaturePerId *> landmarks;
+    vector<Observation> observations;
     for (auto &it_per_id : f_manager.feature)  // 遍历所有路标点
     {
-        double err = 0;
-        int errCnt = 0;
         it_per_id.used_num = it_per_id.feature_per_frame.size();  //也即观察到该路标点的图像帧数目 tzhang
         if (it_per_id.used_num < 4)  // 对观测少于4次的路标点，不进行外点判断
             continue;
-        feature_index ++;
+        int landmark = landmarks.size();
+        landmarks.push_back(&it_per_id);
         int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
-        Vector3d pts_i = it_per_id.feature_per_frame[0].point;
-        double depth = it_per_id.estimated_depth;
         for (auto &it_per_frame : it_per_id.feature_per_frame)
         {
             imu_j++;
-            if (imu_i != imu_j)  //不同时刻，左相机在不同帧之间的重投影误差计算 
-            {
-                Vector3d pts_j = it_per_frame.point;             
-                double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[0], tic[0], 
-                                                    Rs[imu_j], Ps[imu_j], ric[0], tic[0],
-                                                    depth, pts_i, pts_j);
-                err += tmp_error;
-                errCnt++;
-                //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
-            }
+            if (imu_i != imu_j)  //不同时刻，左相机在不同帧之间的重投影误差计算
+                observations.push_back(Observation{landmark, imu_j, 0, &it_per_frame});
             // need to rewrite projecton factor.........
-            if(STEREO && it_per_frame.is_stereo)  // 双目情形
-            {
-                
-                Vector3d pts_j_right = it_per_frame.pointRight;
-                if(imu_i != imu_j)  //不同时刻，左右图像帧之间的重投影误差
-                {            
-                    double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[0], tic[0], 
-                                                        Rs[imu_j], Ps[imu_j], ric[1], tic[1],
-                                                        depth, pts_i, pts_j_right);
-                    err += tmp_error;
-                    errCnt++;
-                    //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
-                }
-                else  //相同时刻，左右图像帧之间的重投影误差 TODO(tzhang)：此处不同时刻判断没啥用，代码冗余
-                {
-                    double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[0], tic[0], //
-                                                        Rs[imu_j], Ps[imu_j], ric[1], tic[1],
-                                                        depth, pts_i, pts_j_right);
-                    err += tmp_error;
-                    errCnt++;
-                    //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
-                }       
-            }
+            if (STEREO && it_per_frame.is_stereo)  // 双目情形，包括同一时刻左右图像帧之间的重投影误差
+                observations.push_back(Observation{landmark, imu_j, 1, &it_per_frame});
         }
-        double ave_err = err / errCnt;
-        if(ave_err * FOCAL_LENGTH > 3)  // 若平均的重投影均方根过大，则判定该路标点为外点; 添加该路标点编号至removeIndex中
-            removeIndex.insert(it_per_id.feature_id);
+    }
+
+    vector<double> errors(observations.size());
+    thread_pool.parallelFor(observations.size(), [&](int begin, int end, int)
+    {
+        for (int k = begin; k < end; k++)
+        {
+            const Observation &obs = observations[k];
+            const FeaturePerId &it_per_id = *landmarks[obs.landmark];
+            int imu_i = it_per_id.start_frame;
+            Vector3d pts_w = R_wc[0][imu_i] * (it_per_id.estimated_depth * it_per_id.feature_per_frame[0].point()) + t_wc[0][imu_i];  //路标点在世界坐标系下的坐标
+            Vector3d pts_cj = R_wc[obs.cam][obs.frame].transpose() * (pts_w - t_wc[obs.cam][obs.frame]);  //路标点在j时刻左或右相机坐标系下的坐标
+            Vector2d pts_j = obs.cam == 0 ? obs.per_frame->point().head<2>() : obs.per_frame->pointRight().head<2>();
+            errors[k] = ((pts_cj / pts_cj.z()).head<2>() - pts_j).norm();  //归一化相机坐标系下的重投影误差
+        }
+    });
 
+    memset(reproj_histogram, 0, sizeof(reproj_histogram));
+    vector<double> err(landmarks.size(), 0);
+    vector<int> errCnt(landmarks.size(), 0);
+    for (size_t k = 0; k < observations.size(); k++)
+    {
+        err[observations[k].landmark] += errors[k];
+        errCnt[observations[k].landmark]++;
+        int bin = min(REPROJ_HIST_BINS - 1, (int)(errors[k] * FOCAL_LENGTH / 0.5));
+        reproj_histogram[observations[k].cam][bin]++;
+    }
+    for (size_t l = 0; l < landmarks.size(); l++)
+    {
+        double ave_err = err[l] / errCnt[l];
+        if(ave_err * FOCAL_LENGTH > 3)  // 若平均的重投影均方根过大，则判定该路标点为外点; 添加该路标点编号至removeIndex中
+            removeIndex.insert(landmarks[l]->feature_id);
     }
 }
 
@@ -1766,10 +2074,10 @@ void Estimator::fastPredictIMU(double t, Eigen::Vector3d linear_acceleration, Ei
 {
     double dt = t - latest_time;
     latest_time = t;
-    Eigen::Vector3d un_acc_0 = latest_Q * (latest_acc_0 - latest_Ba) - g;
+    Eigen::Vector3d un_acc_0 = latest_Q * (latest_acc_0 - latest_Ba) - latest_g;
     Eigen::Vector3d un_gyr = 0.5 * (latest_gyr_0 + angular_velocity) - latest_Bg;
     latest_Q = latest_Q * Utility::deltaQ(un_gyr * dt);
-    Eigen::Vector3d un_acc_1 = latest_Q * (linear_acceleration - latest_Ba) - g;
+    Eigen::Vector3d un_acc_1 = latest_Q * (linear_acceleration - latest_Ba) - latest_g;
     Eigen::Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
     latest_P = latest_P + dt * latest_V + 0.5 * dt * dt * un_acc;
     latest_V = latest_V + dt * un_acc;
@@ -1777,29 +2085,39 @@ void Estimator::fastPredictIMU(double t, Eigen::Vector3d linear_acceleration, Ei
     latest_gyr_0 = angular_velocity;
 }
 
-void Estimator::updateLatestStates()  //获取滑窗中最新帧时刻的状态，并在世界坐标系下进行中值积分；初始化完成后，最新状态在inputIMU函数中发布
+void Estimator::updateLatestStates()  //发布滑窗中最新帧时刻的状态；IMU线程在inputIMU中据此重新传播并发布最新状态
 {
-    mPropagate.lock();
-    latest_time = Headers[frame_count] + td;
-    latest_P = Ps[frame_count];
-    latest_Q = Rs[frame_count];
-    latest_V = Vs[frame_count];
-    latest_Ba = Bas[frame_count];
-    latest_Bg = Bgs[frame_count];
-    latest_acc_0 = acc_0;
-    latest_gyr_0 = gyr_0;
-    mBuf.lock();
-    queue<pair<double, Eigen::Vector3d>> tmp_accBuf = accBuf;
-    queue<pair<double, Eigen::Vector3d>> tmp_gyrBuf = gyrBuf;
-    mBuf.unlock();
-    while(!tmp_accBuf.empty())
+    LatestState state;
+    state.time = Headers[frame_count] + td;
+    state.P = Ps[frame_count];
+    state.Q = Rs[frame_count];
+    state.V = Vs[frame_count];
+    state.Ba = Bas[frame_count];
+    state.Bg = Bgs[frame_count];
+    state.acc_0 = acc_0;
+    state.gyr_0 = gyr_0;
+    state.g = g;
+    latest_anchor.write(state);
+}
+
+void Estimator::repropagateLatestStates()  //仅在IMU回调线程中调用：以后端最新状态为起点，对其后的IMU数据进行中值积分
+{
+    LatestState state;
+    latest_anchor_version = latest_anchor.read(state);
+    latest_time = state.time;
+    latest_P = state.P;
+    latest_Q = state.Q;
+    latest_V = state.V;
+    latest_Ba = state.Ba;
+    latest_Bg = state.Bg;
+    latest_acc_0 = state.acc_0;
+    latest_gyr_0 = state.gyr_0;
+    latest_g = state.g;
+    while (!propAccBuf.empty() && propAccBuf.front().first <= latest_time)
     {
-        double t = tmp_accBuf.front().first;
-        Eigen::Vector3d acc = tmp_accBuf.front().second;
-        Eigen::Vector3d gyr = tmp_gyrBuf.front().second;
-        fastPredictIMU(t, acc, gyr);  //世界坐标系下进行中值积分
-        tmp_accBuf.pop();
-        tmp_gyrBuf.pop();
+        propAccBuf.pop_front();
+        propGyrBuf.pop_front();
     }
-    mPropagate.unlock();
+    for (size_t i = 0; i < propAccBuf.size(); i++)
+        fastPredictIMU(propAccBuf[i].first, propAccBuf[i].second, propGyrBuf[i].second);  //世界坐标系下进行中值积分
 }
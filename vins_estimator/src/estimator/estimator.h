@@ -24,11 +24,15 @@
 #include "feature_manager.h"
 #include "../utility/utility.h"
 #include "../utility/tic_toc.h"
+#include "../utility/parameter_pool.h"
+#include "../utility/double_buffer.h"
+#include "../utility/thread_pool.h"
 #include "../initial/solve_5pts.h"
 #include "../initial/initial_sfm.h"
 #include "../initial/initial_alignment.h"
 #include "../initial/initial_ex_rotation.h"
 #include "../factor/imu_factor.h"
+#include "../factor/integration_pool.h"
 #include "../factor/pose_local_parameterization.h"
 #include "../factor/marginalization_factor.h"
 #include "../factor/projectionTwoFrameOneCamFactor.h"
@@ -37,6 +41,36 @@
 #include "../featureTracker/feature_tracker.h"
 
 
+struct LatestState  //后端发布的最新帧状态，作为IMU线程快速传播的起点
+{
+    double time;
+    Eigen::Vector3d P, V, Ba, Bg, acc_0, gyr_0, g;
+    Eigen::Quaterniond Q;
+};
+
+struct EstimatorSnapshot  //滑窗状态快照：非线性优化阶段每隔SNAPSHOT_INTERVAL帧保存一次，故障时回滚到此处，无需重新初始化
+{
+    bool valid;
+    double Headers[(WINDOW_SIZE + 1)];
+    Vector3d Ps[(WINDOW_SIZE + 1)];
+    Vector3d Vs[(WINDOW_SIZE + 1)];
+    Matrix3d Rs[(WINDOW_SIZE + 1)];
+    Vector3d Bas[(WINDOW_SIZE + 1)];
+    Vector3d Bgs[(WINDOW_SIZE + 1)];
+    Matrix3d ric[2];
+    Vector3d tic[2];
+    double td;
+    Vector3d acc_0, gyr_0;
+    Matrix3d last_R, last_R0;
+    Vector3d last_P, last_P0;
+    IntegrationBase *pre_integrations[(WINDOW_SIZE + 1)];  //取自integration_pool，按值复制滑窗中的预积分
+    vector<ImuSample> imu_samples;  //预积分所引用的IMU数据，对应arena下标区间[imu_begin, imu_end)
+    size_t imu_begin, imu_end;
+    FeatureManagerState features;
+    MarginalizationInfo *prior;  //边缘化先验的副本
+    vector<double *> prior_parameter_blocks;
+};
+
 class Estimator
 {
   public:
@@ -56,8 +90,16 @@ class Estimator
 
     // internal
     void clearState();
+    void eraseImageFrames(map<double, ImageFrame>::iterator first, map<double, ImageFrame>::iterator last);
+    void pruneImageFrames();
+    void trimImuArena();
+    void integrateIMU(size_t index);
+    void saveSnapshot();
+    bool restoreSnapshot(double header);
+    void releaseSnapshot();
     bool initialStructure();
     bool visualInitialAlign();
+    bool stereoInertialAlign();
     bool relativePose(Matrix3d &relative_R, Vector3d &relative_T, int &l);
     void slideWindow();
     void slideWindowNew();
@@ -77,6 +119,7 @@ class Estimator
                                      double depth, Vector3d &uvi, Vector3d &uvj);
     void updateLatestStates(); //,用来预测最新P,V,Q的姿态
     void fastPredictIMU(double t, Eigen::Vector3d linear_acceleration, Eigen::Vector3d angular_velocity);
+    void repropagateLatestStates();
     bool IMUAvailable(double t);
     void initFirstIMUPose(vector<pair<double, Eigen::Vector3d>> &accVector);
 
@@ -92,9 +135,8 @@ class Estimator
         MARGIN_SECOND_NEW = 1
     };
 
-    std::mutex mProcess;
+    std::recursive_mutex mProcess;  //processImage中故障重启时clearState、setParameter会在持有该锁的线程内再次加锁
     std::mutex mBuf;
-    std::mutex mPropagate;
     queue<pair<double, Eigen::Vector3d>> accBuf;
     queue<pair<double, Eigen::Vector3d>> gyrBuf;
     queue<pair<double, map<int, vector<pair<int, Eigen::Matrix<double, 7, 1> > > > > > featureBuf;
@@ -130,9 +172,7 @@ class Estimator
                           //但是要计算一个个预积分，需要知道这个预积分开头的帧当前的加速度以及角速度，以这个基准来建立的。
                           //每次使用完这个函数都会更新acc_0，gyr_0的值，即当要建立一个新的预积分的时候，这个基准直接从acc_0，gyr_0获取
 
-    vector<double> dt_buf[(WINDOW_SIZE + 1)];
-    vector<Vector3d> linear_acceleration_buf[(WINDOW_SIZE + 1)];
-    vector<Vector3d> angular_velocity_buf[(WINDOW_SIZE + 1)];
+    ImuSampleArena imu_arena;  //滑窗内的IMU数据只存一份，各预积分按下标区间引用
 
     int frame_count; //滑窗中图片的帧数,代表当前处理的这一帧在滑动窗口中的第几个。取值范围是在0到WINDOW_SIZE之间。
     int sum_of_outlier, sum_of_back, sum_of_front, sum_of_invalid;
@@ -151,11 +191,12 @@ class Estimator
     vector<Vector3d> margin_cloud;
     vector<Vector3d> key_poses;
     double initial_timestamp;
+    double init_start_time;  //初始化阶段第一帧的时间戳，用于统计初始化耗时
 
     //视觉测量残差.以三角化的特征点一个个进行添加残差。具体过程，假设第l个特征点（在代码中用feature_index表示），第一次被第i帧图像观察到（代码中用imu_i表示），那个这个特征点在第j帧图像中（代码中用imu_j表示）的残差,即
     double para_Pose[WINDOW_SIZE + 1][SIZE_POSE]; //滑动窗口内11帧的位姿，6自由度7变量表示 SIZE_POSE: 7
     double para_SpeedBias[WINDOW_SIZE + 1][SIZE_SPEEDBIAS]; //滑动窗口11帧对应的速度,ba,bg,9自由度。SIZE_SPEEDBIAS: 9,当没有使用imu的时候，para_SpeedBias就没有加入待求变量中，并且把para_Pose[0]设置为常量。
-    double para_Feature[NUM_OF_F][SIZE_FEATURE];
+    ParameterBlockPool<SIZE_FEATURE> para_Feature;  //路标点逆深度，按需扩容且地址稳定
     double para_Ex_Pose[2][SIZE_POSE]; //相机到IMU的外参变换矩阵，6自由度7变量表示 SIZE_POSE: 7,当我们有精确的相机到imu的外参时候，para_Ex_Pose也设置为常量。
     double para_Retrive_Pose[SIZE_POSE];
     double para_Td[1][1];// 滑窗内第一个时刻的相机到IMU的时钟差,如果使用同步的VI设备的话，para_Td也作为一个常量。
@@ -166,8 +207,9 @@ class Estimator
     MarginalizationInfo *last_marginalization_info; //边缘化的残差项。观察变量
 
     vector<double *> last_marginalization_parameter_blocks;  //保存上一次边缘化后，保留的状态向量的内存地址
-    map<double, ImageFrame> all_image_frame;  //存储所有的图像帧数据
+    map<double, ImageFrame> all_image_frame;  //初始化阶段的图像帧数据，持有各帧的预积分，最多MAX_IMAGE_FRAMES帧
     IntegrationBase *tmp_pre_integration;
+    IntegrationPool integration_pool{&imu_arena};  //预积分对象池，滑窗中的预积分对象均从此获取和归还
 
     Eigen::Vector3d initP;
     Eigen::Matrix3d initR;
@@ -175,9 +217,20 @@ class Estimator
     double latest_time;
  
     //P是位置，Q是四元数字，V是速度
-    Eigen::Vector3d latest_P, latest_V, latest_Ba, latest_Bg, latest_acc_0, latest_gyr_0;
+    Eigen::Vector3d latest_P, latest_V, latest_Ba, latest_Bg, latest_acc_0, latest_gyr_0, latest_g;
     Eigen::Quaterniond latest_Q;
 
+    DoubleBuffer<LatestState> latest_anchor;  //后端写、IMU线程读，无锁
+    unsigned int latest_anchor_version;  //IMU线程已使用的起点版本
+    deque<pair<double, Eigen::Vector3d>> propAccBuf;  //IMU线程保留的近期IMU数据，新起点到来时从中重新传播
+    deque<pair<double, Eigen::Vector3d>> propGyrBuf;
+
+    ThreadPool thread_pool;  //后端常驻线程池，线程数由BACKEND_THREADS设置
+    LocalMap local_map;  //滑窗外路标点的局部地图，LOCAL_MAP开启时使用
+    EstimatorSnapshot snapshot;  //最近一次正常状态的快照，SNAPSHOT_INTERVAL > 0时使用
+    int frames_since_snapshot;
+    int reproj_histogram[2][REPROJ_HIST_BINS];  //最近一次外点检测中左右相机的重投影误差（像素）直方图
+
     bool initFirstPoseFlag;  //标记位姿是否初始化 tzhang 
     bool initThreadFlag;
 };
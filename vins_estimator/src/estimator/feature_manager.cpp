@@ -15,7 +15,7 @@ int FeaturePerId::endFrame()
 }
 
 FeatureManager::FeatureManager(Matrix3d _Rs[])
-    : Rs(_Rs)
+    : Rs(_Rs), long_feature_num(0), thread_pool(nullptr), local_map(nullptr)
 {
     for (int i = 0; i < NUM_OF_CAM; i++)
         ric[i].setIdentity();
@@ -29,23 +29,76 @@ void FeatureManager::setRic(Matrix3d _ric[])
     }
 }
 
+void FeatureManager::setThreadPool(ThreadPool *_thread_pool)
+{
+    thread_pool = _thread_pool;
+}
+
+void FeatureManager::setLocalMap(LocalMap *_local_map)
+{
+    local_map = _local_map;
+}
+
 void FeatureManager::clearState()
 {
     feature.clear();
+    feature_slot.clear();
+    long_feature_num = 0;
+    prev_frame_ids.clear();
+}
+
+void FeatureManager::saveState(FeatureManagerState &state) const  //复制赋值，快照的容器容量可重复利用
+{
+    state.feature = feature;
+    state.feature_slot = feature_slot;
+    state.prev_frame_ids = prev_frame_ids;
+    state.last_track_num = last_track_num;
+    state.last_average_parallax = last_average_parallax;
+    state.new_feature_num = new_feature_num;
+    state.long_track_num = long_track_num;
+    state.long_feature_num = long_feature_num;
 }
 
-int FeatureManager::getFeatureCount()  // 返回观测次数超过4次的路标点数目
+void FeatureManager::restoreState(const FeatureManagerState &state)
 {
-    int cnt = 0;
-    for (auto &it : feature)
+    feature = state.feature;
+    feature_slot = state.feature_slot;
+    prev_frame_ids = state.prev_frame_ids;
+    last_track_num = state.last_track_num;
+    last_average_parallax = state.last_average_parallax;
+    new_feature_num = state.new_feature_num;
+    long_track_num = state.long_track_num;
+    long_feature_num = state.long_feature_num;
+}
+
+int FeatureManager::getFeatureCount()  // 返回观测次数不少于4次的路标点数目
+{
+    return long_feature_num;
+}
+
+// 对每个路标点调用func（可在其中修改路标点），返回true的路标点被删除；其余路标点保持相对顺序前移，同时更新索引与计数
+template <typename Func>
+void FeatureManager::compactFeatures(Func func)
+{
+    int num_keep = 0;
+    long_feature_num = 0;
+    for (int i = 0; i < (int)feature.size(); i++)
     {
-        it.used_num = it.feature_per_frame.size();
-        if (it.used_num >= 4)
+        if (func(feature[i]))
         {
-            cnt++;
+            feature_slot.erase(feature[i].feature_id);
+            continue;
         }
+        if (num_keep != i)
+        {
+            feature[num_keep] = std::move(feature[i]);
+            feature_slot[feature[num_keep].feature_id] = num_keep;
+        }
+        if (feature[num_keep].feature_per_frame.size() >= 4)
+            long_feature_num++;
+        num_keep++;
     }
-    return cnt;
+    feature.erase(feature.begin() + num_keep, feature.end());
 }
 
 
@@ -59,8 +112,11 @@ int FeatureManager::getFeatureCount()  // 返回观测次数超过4次的路标
  * VINS里为了控制优化计算量，在实时情况下，只对当前帧之前某一部分帧进行优化，而不是全部历史帧。局部优化帧的数量就是窗口大小。
  * 为了维持窗口大小，需要去除旧的帧添加新的帧，也就是边缘化 Marginalization。到底是删去最旧的帧（MARGIN_OLD）还是删去刚刚进来窗口倒数第二帧(MARGIN_SECOND_NEW)
  * 如果大于最小像素,则返回true 
+ * 视差只需计算在第frame_count-1帧（即上一次输入的图像帧）中被观测到的路标点，因此只遍历上一帧的路标点ID，代价与每帧观测数成正比
+ * delta_R不为空时为第frame_count-2帧到第frame_count-1帧的IMU旋转（陀螺仪积分），用于补偿纯旋转引起的视差
 **/
-bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, double td)
+bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, double td,
+                                             const Matrix3d *delta_R)
 {
     ROS_DEBUG("input feature: %d", (int)image.size());
     ROS_DEBUG("num of feature: %d", getFeatureCount());
@@ -70,6 +126,7 @@ bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vec
     last_average_parallax = 0;
     new_feature_num = 0;
     long_track_num = 0;
+    cur_frame_ids.clear();
     for (auto &id_pts : image)
     {
         FeaturePerFrame f_per_fra(id_pts.second[0].second, td);  //基于左图特征，创建FeaturePerFrame
@@ -81,53 +138,67 @@ bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vec
         }
 
         int feature_id = id_pts.first;  //特征点的ID
-        auto it = find_if(feature.begin(), feature.end(), [feature_id](const FeaturePerId &it)
-                          {
-            return it.feature_id == feature_id;
-                          });
+        cur_frame_ids.push_back(feature_id);
+        auto it = feature_slot.find(feature_id);
 
-        if (it == feature.end())  //该路标点之前还未被观测
+        if (it == feature_slot.end())  //该路标点之前还未被观测
         {
+            feature_slot[feature_id] = feature.size();
             feature.push_back(FeaturePerId(feature_id, frame_count));
             feature.back().feature_per_frame.push_back(f_per_fra);  //添加观测到该路标点的图像帧信息
             new_feature_num++;
         }
-        else if (it->feature_id == feature_id)
+        else
         {
-            it->feature_per_frame.push_back(f_per_fra);  //添加观测到该路标点的图像帧信息
+            FeaturePerId &it_per_id = feature[it->second];
+            it_per_id.feature_per_frame.push_back(f_per_fra);  //添加观测到该路标点的图像帧信息
             last_track_num++;
-            if( it-> feature_per_frame.size() >= 4)  //该路标点被至少四个图像帧观测到
+            if (it_per_id.feature_per_frame.size() == 4)
+                long_feature_num++;
+            if (it_per_id.feature_per_frame.size() >= 4)  //该路标点被至少四个图像帧观测到
                 long_track_num++;
         }
     }
 
     //if (frame_count < 2 || last_track_num < 20)
     //if (frame_count < 2 || last_track_num < 20 || new_feature_num > 0.5 * last_track_num)
+    bool is_keyframe = true;
     if (frame_count < 2 || last_track_num < 20 || long_track_num < 40 || new_feature_num > 0.5 * last_track_num)  // 关键帧判断的策略1（PS:long_track_num < 40没啥用）
     //a、滑窗中图像帧数目少于2帧;  b、跟踪到的路标点数量少于20个;  c、新观测到的路标点数目大于0.5倍跟踪的路标点数目;
-        return true;
-
-    for (auto &it_per_id : feature)  //关键帧判断的策略2（视差足够大（PS:注意计算视差的路标点需满足条件判断））：
+        is_keyframe = true;
+    else
     {
-        if (it_per_id.start_frame <= frame_count - 2 &&  //最开始观测到该路标点的图像帧，距离最新帧不小于2
-            it_per_id.start_frame + int(it_per_id.feature_per_frame.size()) - 1 >= frame_count - 1) // 在最新帧中能够被观测到
+        Matrix3d R_comp;  //将第frame_count-2帧左相机坐标系下的方向旋转到第frame_count-1帧左相机坐标系
+        if (delta_R)
+            R_comp = ric[0].transpose() * delta_R->transpose() * ric[0];
+        for (int feature_id : prev_frame_ids)  //关键帧判断的策略2（视差足够大（PS:注意计算视差的路标点需满足条件判断））：
         {
-            parallax_sum += compensatedParallax2(it_per_id, frame_count);
-            parallax_num++;
+            auto it = feature_slot.find(feature_id);
+            if (it == feature_slot.end())  //已被剔除
+                continue;
+            const FeaturePerId &it_per_id = feature[it->second];
+            if (it_per_id.start_frame <= frame_count - 2 &&  //最开始观测到该路标点的图像帧，距离最新帧不小于2
+                it_per_id.start_frame + int(it_per_id.feature_per_frame.size()) - 1 >= frame_count - 1) // 在最新帧中能够被观测到
+            {
+                parallax_sum += compensatedParallax2(it_per_id, frame_count, delta_R ? &R_comp : nullptr);
+                parallax_num++;
+            }
         }
-    }
 
-    if (parallax_num == 0)
-    {
-        return true;
-    }
-    else
-    {
-        ROS_DEBUG("parallax_sum: %lf, parallax_num: %d", parallax_sum, parallax_num);
-        ROS_DEBUG("current parallax: %lf", parallax_sum / parallax_num * FOCAL_LENGTH);
-        last_average_parallax = parallax_sum / parallax_num * FOCAL_LENGTH;
-        return parallax_sum / parallax_num >= MIN_PARALLAX;  //关键帧判断策略2, 平均视差大于设定的最小值
+        if (parallax_num == 0)
+        {
+            is_keyframe = true;
+        }
+        else
+        {
+            ROS_DEBUG("parallax_sum: %lf, parallax_num: %d", parallax_sum, parallax_num);
+            ROS_DEBUG("current parallax: %lf", parallax_sum / parallax_num * FOCAL_LENGTH);
+            last_average_parallax = parallax_sum / parallax_num * FOCAL_LENGTH;
+            is_keyframe = parallax_sum / parallax_num >= MIN_PARALLAX;  //关键帧判断策略2, 平均视差大于设定的最小值
+        }
     }
+    prev_frame_ids.swap(cur_frame_ids);
+    return is_keyframe;
 }
 
 vector<pair<Vector3d, Vector3d>> FeatureManager::getCorresponding(int frame_count_l, int frame_count_r)
@@ -141,9 +212,9 @@ vector<pair<Vector3d, Vector3d>> FeatureManager::getCorresponding(int frame_coun
             int idx_l = frame_count_l - it.start_frame;
             int idx_r = frame_count_r - it.start_frame;
 
-            a = it.feature_per_frame[idx_l].point;  //返回路标点在左归一化相机坐标系下的位置坐标
+            a = it.feature_per_frame[idx_l].point();  //返回路标点在左归一化相机坐标系下的位置坐标
 
-            b = it.feature_per_frame[idx_r].point;
+            b = it.feature_per_frame[idx_r].point();
             
             corres.push_back(make_pair(a, b));  //构建位置pair
         }
@@ -173,13 +244,7 @@ void FeatureManager::setDepth(const VectorXd &x)
 
 void FeatureManager::removeFailures()
 {
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
-    {
-        it_next++;
-        if (it->solve_flag == 2)
-            feature.erase(it);
-    }
+    compactFeatures([](FeaturePerId &it) { return it.solve_flag == 2; });
 }
 
 void FeatureManager::clearDepth()
@@ -207,20 +272,30 @@ VectorXd FeatureManager::getDepthVector()
 }
 
 
+// DLT法方程：将观测f在投影矩阵P下的两行约束a累加到A^T A中
+void FeatureManager::addDLTConstraint(Eigen::Matrix4d &AtA, const Eigen::Matrix<double, 3, 4> &P, const Eigen::Vector3d &f)
+{
+    Eigen::Matrix<double, 2, 4> a;
+    a.row(0) = f[0] * P.row(2) - f[2] * P.row(0);
+    a.row(1) = f[1] * P.row(2) - f[2] * P.row(1);
+    AtA.noalias() += a.transpose() * a;
+}
+
+// A^T A最小特征值对应的特征向量，即A最小奇异值对应的右奇异向量（齐次坐标）
+Eigen::Vector4d FeatureManager::solveDLT(const Eigen::Matrix4d &AtA)
+{
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> saes(AtA);
+    return saes.eigenvectors().col(0);
+}
+
 void FeatureManager::triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen::Matrix<double, 3, 4> &Pose1,
                         Eigen::Vector2d &point0, Eigen::Vector2d &point1, Eigen::Vector3d &point_3d)
-{  //使用SVD来三角化路标点 tzhang
-    Eigen::Matrix4d design_matrix = Eigen::Matrix4d::Zero();
-    design_matrix.row(0) = point0[0] * Pose0.row(2) - Pose0.row(0);
-    design_matrix.row(1) = point0[1] * Pose0.row(2) - Pose0.row(1);
-    design_matrix.row(2) = point1[0] * Pose1.row(2) - Pose1.row(0);
-    design_matrix.row(3) = point1[1] * Pose1.row(2) - Pose1.row(1);
-    Eigen::Vector4d triangulated_point;
-    triangulated_point =
-              design_matrix.jacobiSvd(Eigen::ComputeFullV).matrixV().rightCols<1>();
-    point_3d(0) = triangulated_point(0) / triangulated_point(3);
-    point_3d(1) = triangulated_point(1) / triangulated_point(3);
-    point_3d(2) = triangulated_point(2) / triangulated_point(3);
+{  //基于4x4法方程的DLT三角化路标点
+    Eigen::Matrix4d AtA = Eigen::Matrix4d::Zero();
+    addDLTConstraint(AtA, Pose0, Eigen::Vector3d(point0[0], point0[1], 1.0));
+    addDLTConstraint(AtA, Pose1, Eigen::Vector3d(point1[0], point1[1], 1.0));
+    Eigen::Vector4d triangulated_point = solveDLT(AtA);
+    point_3d = triangulated_point.head<3>() / triangulated_point(3);
 }
 
 /**利用pnp求解位姿
@@ -276,13 +351,89 @@ bool FeatureManager::solvePoseByPnP(Eigen::Matrix3d &R, Eigen::Vector3d &P,
 }
 
 
+/**以Huber加权的高斯牛顿法求解位姿，R、P输入为初值，输出为结果（均为w_T_cam）
+ * 位姿以R_c_w、t_c_w表示，更新量为[dtheta, dt]：R_c_w <- Exp(dtheta) * R_c_w，t_c_w <- t_c_w + dt
+ * 法方程为固定的6x6，不做动态内存分配；点数不足、求解失败或内点不足一半时返回false
+**/
+bool FeatureManager::solvePoseByGaussNewton(Eigen::Matrix3d &R, Eigen::Vector3d &P,
+                                            const vector<Eigen::Vector3d> &pts2D, const vector<Eigen::Vector3d> &pts3D)
+{
+    const double huber = 2.0 / FOCAL_LENGTH;  //Huber阈值，2个像素
+    const double inlier_thres = 3.0 / FOCAL_LENGTH;
+    int num = pts2D.size();
+    if (num < 4)
+        return false;
+
+    Eigen::Matrix3d R_cw = R.transpose();
+    Eigen::Vector3d t_cw = -(R_cw * P);
+    for (int iter = 0; iter < 10; iter++)
+    {
+        Eigen::Matrix<double, 6, 6> H = Eigen::Matrix<double, 6, 6>::Zero();
+        Eigen::Matrix<double, 6, 1> g = Eigen::Matrix<double, 6, 1>::Zero();
+        int num_valid = 0;
+        for (int k = 0; k < num; k++)
+        {
+            Eigen::Vector3d Rx = R_cw * pts3D[k];
+            Eigen::Vector3d pc = Rx + t_cw;  //路标点在相机坐标系下的坐标
+            if (pc.z() < 1e-3)
+                continue;
+            double inv_z = 1.0 / pc.z();
+            Eigen::Vector2d e = pc.head<2>() * inv_z - pts2D[k].head<2>();
+            double e_norm = e.norm();
+            double w = e_norm <= huber ? 1.0 : huber / e_norm;
+            Eigen::Matrix<double, 2, 3> J_proj;
+            J_proj << inv_z, 0, -pc.x() * inv_z * inv_z,
+                      0, inv_z, -pc.y() * inv_z * inv_z;
+            Eigen::Matrix<double, 2, 6> J;
+            J.leftCols<3>() = -J_proj * Utility::skewSymmetric(Rx);
+            J.rightCols<3>() = J_proj;
+            H.noalias() += w * J.transpose() * J;
+            g.noalias() -= w * J.transpose() * e;
+            num_valid++;
+        }
+        if (num_valid < 4)
+            return false;
+
+        Eigen::Matrix<double, 6, 1> dx = H.ldlt().solve(g);
+        if (!dx.allFinite())
+            return false;
+        R_cw = Utility::deltaQ(Eigen::Vector3d(dx.head<3>())).normalized().toRotationMatrix() * R_cw;
+        t_cw += dx.tail<3>();
+        if (dx.norm() < 1e-6)
+            break;
+    }
+
+    int num_inlier = 0;
+    for (int k = 0; k < num; k++)
+    {
+        Eigen::Vector3d pc = R_cw * pts3D[k] + t_cw;
+        if (pc.z() > 1e-3 && (pc.head<2>() / pc.z() - pts2D[k].head<2>()).norm() < inlier_thres)
+            num_inlier++;
+    }
+    if (2 * num_inlier < num)
+    {
+        ROS_DEBUG("gauss-newton pnp: %d / %d inliers, fall back to solvePnP", num_inlier, num);
+        return false;
+    }
+
+    // cam_T_w ---> w_T_cam
+    R = R_cw.transpose();
+    P = -(R * t_cw);
+    return true;
+}
+
+/**利用PnP求解当前帧位姿
+ * 收集已三角化、且在当前帧中被观测到的路标点，得到3D-2D点对（缓存复用，避免每帧重新分配）；
+ * 以当前帧的姿态Rs[frameCnt]（有IMU时为陀螺仪递推结果，否则为上一帧姿态）和上一帧的位置为初值，
+ * 先用高斯牛顿法求解，失败时再用cv::solvePnP求解
+**/
 void FeatureManager::initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[])
 {
 
     if(frameCnt > 0)  //对第一帧图像不做处理；因为此时路标点还未三角化，需要利用第一帧双目图像，进行路标点三角化 tzhang
     {
-        vector<cv::Point2f> pts2D;
-        vector<cv::Point3f> pts3D;
+        pnp_pts2d.clear();
+        pnp_pts3d.clear();
         for (auto &it_per_id : feature)  //遍历每个路标点 tzhang
         {
             if (it_per_id.estimated_depth > 0)  //该路标点完成了初始化，使用初始化完成的路标点，获取3D-2D点对  tzhang
@@ -290,207 +441,222 @@ void FeatureManager::initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs
                 int index = frameCnt - it_per_id.start_frame;
                 if((int)it_per_id.feature_per_frame.size() >= index + 1)  //tzhang  该路标点从start_frame图像帧到frameCnt对应的图像帧都能被观测到
                 {
-                    //路标点在IMU坐标系坐标，第一次看到该路标点的图像帧时刻 tzhang  // 前面描述错误，此时不存在imu，应该是在start_frame图像帧左相机坐标系的坐标
-                    Vector3d ptsInCam = ric[0] * (it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth) + tic[0];
+                    //在start_frame图像帧左相机坐标系的坐标
+                    Vector3d ptsInCam = ric[0] * (it_per_id.feature_per_frame[0].point() * it_per_id.estimated_depth) + tic[0];
                     // 路标点在世界坐标系下的坐标
-                    Vector3d ptsInWorld = Rs[it_per_id.start_frame] * ptsInCam + Ps[it_per_id.start_frame];
-
-                    cv::Point3f point3d(ptsInWorld.x(), ptsInWorld.y(), ptsInWorld.z());  //世界坐标系下三维坐标 tzhang
-                    cv::Point2f point2d(it_per_id.feature_per_frame[index].point.x(), it_per_id.feature_per_frame[index].point.y());
-                    pts3D.push_back(point3d);
-                    pts2D.push_back(point2d); 
+                    pnp_pts3d.push_back(Rs[it_per_id.start_frame] * ptsInCam + Ps[it_per_id.start_frame]);
+                    pnp_pts2d.push_back(it_per_id.feature_per_frame[index].point());
                 }
             }
         }
         Eigen::Matrix3d RCam;
         Eigen::Vector3d PCam;
-        // trans to w_T_cam 以上一帧图像与世界坐标系之间的位姿变换作为后续PnP求解的初值 tzhang
-        RCam = Rs[frameCnt - 1] * ric[0];  //R_w_c
-        PCam = Rs[frameCnt - 1] * tic[0] + Ps[frameCnt - 1];
+        // trans to w_T_cam
+        RCam = Rs[frameCnt] * ric[0];  //R_w_c
+        PCam = Rs[frameCnt] * tic[0] + Ps[frameCnt - 1];
 
-        if(solvePoseByPnP(RCam, PCam, pts2D, pts3D))
+        bool succ = solvePoseByGaussNewton(RCam, PCam, pnp_pts2d, pnp_pts3d);
+        if (!succ)
+        {
+            vector<cv::Point2f> pts2D;
+            vector<cv::Point3f> pts3D;
+            for (size_t k = 0; k < pnp_pts3d.size(); k++)
+            {
+                pts3D.push_back(cv::Point3f(pnp_pts3d[k].x(), pnp_pts3d[k].y(), pnp_pts3d[k].z()));  //世界坐标系下三维坐标 tzhang
+                pts2D.push_back(cv::Point2f(pnp_pts2d[k].x(), pnp_pts2d[k].y()));
+            }
+            RCam = Rs[frameCnt] * ric[0];
+            PCam = Rs[frameCnt] * tic[0] + Ps[frameCnt - 1];
+            succ = solvePoseByPnP(RCam, PCam, pts2D, pts3D);
+        }
+        if (succ)
         {
             // trans to w_T_imu
             Rs[frameCnt] = RCam * ric[0].transpose();   //R_w_i = R_w_c*R_c_i
             Ps[frameCnt] = -RCam * ric[0].transpose() * tic[0] + PCam;
-
-            Eigen::Quaterniond Q(Rs[frameCnt]);  //TODO（tzhang）:这个四元数并未使用 
-            //cout << "frameCnt: " << frameCnt <<  " pnp Q " << Q.w() << " " << Q.vec().transpose() << endl;
-            //cout << "frameCnt: " << frameCnt << " pnp P " << Ps[frameCnt].transpose() << endl;
         }
     }
 }
 
 // 双目三角化
 // 结果放入了feature的estimated_depth中
+// 先统一计算各帧左右相机的投影矩阵，再将待三角化的路标点分配给线程池并行求解，各路标点只写自身的深度
 void FeatureManager::triangulate(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[])
 {
-    for (auto &it_per_id : feature)
+    Eigen::Matrix<double, 3, 4> pose[2][WINDOW_SIZE + 1];  //相机在各帧的位姿[R_c_w | t_c_w]
+    for (int i = 0; i <= WINDOW_SIZE; i++)
     {
-        if (it_per_id.estimated_depth > 0)
-            continue;
-
-        if(STEREO && it_per_id.feature_per_frame[0].is_stereo)  //双目版本，利用双目图像对路标点进行三角化
+        for (int c = 0; c < NUM_OF_CAM; c++)
         {
-            int imu_i = it_per_id.start_frame;
-            Eigen::Matrix<double, 3, 4> leftPose;  //第一帧，左相机到世界坐标系的位姿 tzhang
-            Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];//利用imu的位姿
-            Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];  //R_w_c  tzhang 利用imu的位姿计算左相机位姿
-            leftPose.leftCols<3>() = R0.transpose();  //R_c_w
-            leftPose.rightCols<1>() = -R0.transpose() * t0;
-            //cout << "left pose " << leftPose << endl;
-
-            Eigen::Matrix<double, 3, 4> rightPose;  //第一帧，右相机到世界坐标系的位姿 tzhang
-            Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[1];
-            Eigen::Matrix3d R1 = Rs[imu_i] * ric[1];//利用imu的位姿计算右相机位姿
-            rightPose.leftCols<3>() = R1.transpose();
-            rightPose.rightCols<1>() = -R1.transpose() * t1;
-            //cout << "right pose " << rightPose << endl;
-
-            Eigen::Vector2d point0, point1;
-            Eigen::Vector3d point3d;  //路标点在世界坐标系的坐标 tzhang
-            point0 = it_per_id.feature_per_frame[0].point.head(2);
-            point1 = it_per_id.feature_per_frame[0].pointRight.head(2);
-            //cout << "point0 " << point0.transpose() << endl;
-            //cout << "point1 " << point1.transpose() << endl;
-
-            triangulatePoint(leftPose, rightPose, point0, point1, point3d);  //基于SVD的路标点三角化 tzhang
-            Eigen::Vector3d localPoint; //得到imu坐标系下的三维点坐标
-            localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();  //计算该路标点在左相机的坐标  tzhang
-            //TODO(tzhang)：还可以添加右相机的约束，来判别路标点深度初始化是否成功 tzhang
-            double depth = localPoint.z();
-            if (depth > 0)
-                it_per_id.estimated_depth = depth;
-            else
-                it_per_id.estimated_depth = INIT_DEPTH;
-            /*
-            Vector3d ptsGt = pts_gt[it_per_id.feature_id];
-            printf("stereo %d pts: %f %f %f gt: %f %f %f \n",it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
-                                                            ptsGt.x(), ptsGt.y(), ptsGt.z());
-            */
-            continue;
+            Eigen::Vector3d t = Ps[i] + Rs[i] * tic[c];  //利用imu的位姿计算相机位姿
+            Eigen::Matrix3d R = Rs[i] * ric[c];  //R_w_c
+            pose[c][i].leftCols<3>() = R.transpose();  //R_c_w
+            pose[c][i].rightCols<1>() = -R.transpose() * t;
         }
-        else if(it_per_id.feature_per_frame.size() > 1)  //单目版本，利用前后帧图像对路标点进行三角化
+    }
+
+    vector<int> todo;  //尚未初始化深度的路标点
+    int num_reused = 0;
+    for (int k = 0; k < (int)feature.size(); k++)
+    {
+        if (feature[k].estimated_depth > 0)
+            continue;
+        if (local_map && matchLocalMap(feature[k], pose))  //与局部地图中的滑窗外路标点关联成功，直接使用其坐标
         {
-            int imu_i = it_per_id.start_frame;
-            Eigen::Matrix<double, 3, 4> leftPose;
-            Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];
-            Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];
-            leftPose.leftCols<3>() = R0.transpose();
-            leftPose.rightCols<1>() = -R0.transpose() * t0;
-
-            imu_i++;  //以下一帧图像的位姿作为约束，进行三角化 tzhang
-            Eigen::Matrix<double, 3, 4> rightPose;
-            Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[0];
-            Eigen::Matrix3d R1 = Rs[imu_i] * ric[0];
-            rightPose.leftCols<3>() = R1.transpose();
-            rightPose.rightCols<1>() = -R1.transpose() * t1;
-
-            //TODO(tzhang):代码冗余，单目情形下，仅仅构建rightPose的方式与双目不同，后续处理均一致；代码可优化
-            Eigen::Vector2d point0, point1;
-            Eigen::Vector3d point3d;
-            point0 = it_per_id.feature_per_frame[0].point.head(2);
-            point1 = it_per_id.feature_per_frame[1].point.head(2);
-            triangulatePoint(leftPose, rightPose, point0, point1, point3d);
-            Eigen::Vector3d localPoint;
-            localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
-            double depth = localPoint.z();
-            if (depth > 0)
-                it_per_id.estimated_depth = depth;
-            else
-                it_per_id.estimated_depth = INIT_DEPTH;
-            /*
-            Vector3d ptsGt = pts_gt[it_per_id.feature_id];
-            printf("motion  %d pts: %f %f %f gt: %f %f %f \n",it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
-                                                            ptsGt.x(), ptsGt.y(), ptsGt.z());
-            */
+            num_reused++;
             continue;
         }
-        it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (it_per_id.used_num < 4)
-            continue;
-
-        //TODO(tzhang):感觉从此处到函数结束处的代码均不会被条件触发，即后续代码均不会被执行； 可调试并优化
-        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+        todo.push_back(k);
+    }
+    if (local_map)
+        ROS_DEBUG("local map: %d points, %d reused, %d to triangulate", local_map->size(), num_reused, (int)todo.size());
 
-        Eigen::MatrixXd svd_A(2 * it_per_id.feature_per_frame.size(), 4);
-        int svd_idx = 0;
+    std::function<void(int, int, int)> solve = [&](int begin, int end, int)
+    {
+        for (int k = begin; k < end; k++)
+            triangulateFeature(feature[todo[k]], pose, Ps, Rs, tic, ric);
+    };
+    if (thread_pool)
+        thread_pool->parallelFor(todo.size(), solve);
+    else
+        solve(0, todo.size(), 0);
+}
 
-        Eigen::Matrix<double, 3, 4> P0;
-        Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];
-        Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];
-        P0.leftCols<3>() = Eigen::Matrix3d::Identity();
-        P0.rightCols<1>() = Eigen::Vector3d::Zero();
+// 重投影误差（归一化平面），点在相机后方时为无穷大
+static double reprojectionError(const Eigen::Matrix<double, 3, 4> &pose, const Eigen::Vector3d &w_pts, const Eigen::Vector3d &obs)
+{
+    Eigen::Vector3d p = pose * w_pts.homogeneous();
+    if (p.z() < 0.1)
+        return std::numeric_limits<double>::infinity();
+    return (p.head<2>() / p.z() - obs.head<2>()).norm();
+}
 
+// 沿路标点首次观测的光线在局部地图中取候选点，候选点在该路标点所有观测（含右相机）中的重投影误差均小于LOCAL_MAP_MATCH_GATE像素时接受，
+// 多个候选时取最大误差最小者；至少需要两个视角（双目或两帧），只有一个视角时无法区分光线上的点
+bool FeatureManager::matchLocalMap(FeaturePerId &it_per_id, const Eigen::Matrix<double, 3, 4> pose[][WINDOW_SIZE + 1])
+{
+    if (!(STEREO && it_per_id.feature_per_frame[0].is_stereo) && it_per_id.feature_per_frame.size() < 2)
+        return false;
+    const Eigen::Matrix<double, 3, 4> &pose0 = pose[0][it_per_id.start_frame];
+    Eigen::Matrix3d R_w_c = pose0.leftCols<3>().transpose();
+    Eigen::Vector3d origin = -R_w_c * pose0.rightCols<1>();
+    local_map->queryRay(origin, (R_w_c * it_per_id.feature_per_frame[0].point()).normalized(), map_candidates);
+
+    int best = -1;
+    double best_err = LOCAL_MAP_MATCH_GATE / FOCAL_LENGTH;
+    for (int slot : map_candidates)
+    {
+        const Eigen::Vector3d &w_pts = local_map->position(slot);
+        double err = 0;
+        int frame = it_per_id.start_frame;
         for (auto &it_per_frame : it_per_id.feature_per_frame)
         {
-            imu_j++;
-
-            Eigen::Vector3d t1 = Ps[imu_j] + Rs[imu_j] * tic[0];
-            Eigen::Matrix3d R1 = Rs[imu_j] * ric[0];
-            Eigen::Vector3d t = R0.transpose() * (t1 - t0);
-            Eigen::Matrix3d R = R0.transpose() * R1;
-            Eigen::Matrix<double, 3, 4> P;
-            P.leftCols<3>() = R.transpose();
-            P.rightCols<1>() = -R.transpose() * t;
-            Eigen::Vector3d f = it_per_frame.point.normalized();
-            svd_A.row(svd_idx++) = f[0] * P.row(2) - f[2] * P.row(0);
-            svd_A.row(svd_idx++) = f[1] * P.row(2) - f[2] * P.row(1);
-
-            if (imu_i == imu_j)
-                continue;
+            err = max(err, reprojectionError(pose[0][frame], w_pts, it_per_frame.point()));
+            if (STEREO && it_per_frame.is_stereo)
+                err = max(err, reprojectionError(pose[1][frame], w_pts, it_per_frame.pointRight()));
+            if (err >= best_err)
+                break;
+            frame++;
         }
-        ROS_ASSERT(svd_idx == svd_A.rows());
-        Eigen::Vector4d svd_V = Eigen::JacobiSVD<Eigen::MatrixXd>(svd_A, Eigen::ComputeThinV).matrixV().rightCols<1>();
-        double svd_method = svd_V[2] / svd_V[3];
-        //it_per_id->estimated_depth = -b / A;
-        //it_per_id->estimated_depth = svd_V[2] / svd_V[3];
-
-        it_per_id.estimated_depth = svd_method;
-        //it_per_id->estimated_depth = INIT_DEPTH;
-
-        if (it_per_id.estimated_depth < 0.1)
+        if (err < best_err)
         {
-            it_per_id.estimated_depth = INIT_DEPTH;
+            best_err = err;
+            best = slot;
         }
+    }
+    if (best < 0)
+        return false;
+    it_per_id.estimated_depth = (pose0 * local_map->position(best).homogeneous()).z();
+    local_map->erase(best);
+    return true;
+}
+
+void FeatureManager::triangulateFeature(FeaturePerId &it_per_id, const Eigen::Matrix<double, 3, 4> pose[][WINDOW_SIZE + 1],
+                                        Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[])
+{
+    int imu_i = it_per_id.start_frame;
+    if ((STEREO && it_per_id.feature_per_frame[0].is_stereo) ||  //双目版本，利用第一帧的左右图像对路标点进行三角化
+        it_per_id.feature_per_frame.size() > 1)  //单目版本，利用前后帧图像对路标点进行三角化
+    {
+        bool stereo = STEREO && it_per_id.feature_per_frame[0].is_stereo;
+        const Eigen::Matrix<double, 3, 4> &leftPose = pose[0][imu_i];
+        const Eigen::Matrix<double, 3, 4> &rightPose = stereo ? pose[1][imu_i] : pose[0][imu_i + 1];  //单目时以下一帧图像的位姿作为约束
+        Eigen::Vector3d point0 = it_per_id.feature_per_frame[0].point();
+        Eigen::Vector3d point1 = stereo ? it_per_id.feature_per_frame[0].pointRight() : it_per_id.feature_per_frame[1].point();
+
+        Eigen::Matrix4d AtA = Eigen::Matrix4d::Zero();
+        addDLTConstraint(AtA, leftPose, point0);
+        addDLTConstraint(AtA, rightPose, point1);
+        Eigen::Vector4d X = solveDLT(AtA);
+        Eigen::Vector3d point3d = X.head<3>() / X(3);  //路标点在世界坐标系的坐标
+        Eigen::Vector3d localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();  //计算该路标点在左相机的坐标  tzhang
+        //TODO(tzhang)：还可以添加右相机的约束，来判别路标点深度初始化是否成功 tzhang
+        double depth = localPoint.z();
+        if (depth > 0)
+            it_per_id.estimated_depth = depth;
+        else
+            it_per_id.estimated_depth = INIT_DEPTH;
+        return;
+    }
+    it_per_id.used_num = it_per_id.feature_per_frame.size();
+    if (it_per_id.used_num < 4)
+        return;
 
+    //TODO(tzhang):感觉从此处到函数结束处的代码均不会被条件触发，即后续代码均不会被执行； 可调试并优化
+    int imu_j = imu_i - 1;
+    Eigen::Matrix4d AtA = Eigen::Matrix4d::Zero();
+
+    Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];
+    Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];
+
+    for (auto &it_per_frame : it_per_id.feature_per_frame)
+    {
+        imu_j++;
+
+        Eigen::Vector3d t1 = Ps[imu_j] + Rs[imu_j] * tic[0];
+        Eigen::Matrix3d R1 = Rs[imu_j] * ric[0];
+        Eigen::Vector3d t = R0.transpose() * (t1 - t0);
+        Eigen::Matrix3d R = R0.transpose() * R1;
+        Eigen::Matrix<double, 3, 4> P;
+        P.leftCols<3>() = R.transpose();
+        P.rightCols<1>() = -R.transpose() * t;
+        addDLTConstraint(AtA, P, it_per_frame.point().normalized());
+    }
+    Eigen::Vector4d svd_V = solveDLT(AtA);
+    it_per_id.estimated_depth = svd_V[2] / svd_V[3];
+
+    if (it_per_id.estimated_depth < 0.1)
+    {
+        it_per_id.estimated_depth = INIT_DEPTH;
     }
 }
 
 void FeatureManager::removeOutlier(set<int> &outlierIndex)
 {
-    std::set<int>::iterator itSet;
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
+    if (outlierIndex.empty())
+        return;
+    compactFeatures([&](FeaturePerId &it)
     {
-        it_next++;
-        int index = it->feature_id;
-        itSet = outlierIndex.find(index);  // 若路标点编号在outlierIndex里面，则将路标点从feature剔除
-        if(itSet != outlierIndex.end())
-        {
-            feature.erase(it);
-            //printf("remove outlier %d \n", index);
-        }
-    }
+        return outlierIndex.count(it.feature_id) > 0;  // 若路标点编号在outlierIndex里面，则将路标点从feature剔除
+    });
 }
 
 void FeatureManager::removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3d marg_P, Eigen::Matrix3d new_R, Eigen::Vector3d new_P)
 {
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
+    compactFeatures([&](FeaturePerId &it_per_id)
     {
-        it_next++;
-
+        FeaturePerId *it = &it_per_id;
         if (it->start_frame != 0)  //第一次观察到该路标点的图像帧不是被边缘化掉的老的第0帧，将start_frame递减1  tzhang
             it->start_frame--;
         else
         {
-            Eigen::Vector3d uv_i = it->feature_per_frame[0].point;  
-            it->feature_per_frame.erase(it->feature_per_frame.begin());
+            Eigen::Vector3d uv_i = it->feature_per_frame[0].point();  
+            it->feature_per_frame.pop_front();
             if (it->feature_per_frame.size() < 2)
             {
-                feature.erase(it);
-                continue;
+                if (local_map && it->estimated_depth > 0 && it->solve_flag == 1)  //已优化的路标点移入局部地图
+                    local_map->insert(marg_R * (uv_i * it->estimated_depth) + marg_P);
+                return true;
             }
             else  // 该路标点被观测的次数满足要求，将深度信息在新的第0个图像帧中进行表示  tzhang
             {//TODO(tzhang):可以添加该路标点是否在新的第0帧中被观测到的判断；若没观测到则直接剔除该路标点
@@ -511,33 +677,33 @@ void FeatureManager::removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3
             feature.erase(it);
         }
         */
-    }
+        return false;
+    });
+    if (local_map)
+        local_map->prune(new_P);
 }
 
 void FeatureManager::removeBack()
 {
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
+    compactFeatures([](FeaturePerId &it)
     {
-        it_next++;
-
-        if (it->start_frame != 0)  //第一次观测到路标点的图像帧不是被边缘化的滑窗中（也即第0帧）；此时仅将观测到路标点的图像帧索引递减
-            it->start_frame--;
+        if (it.start_frame != 0)  //第一次观测到路标点的图像帧不是被边缘化的滑窗中（也即第0帧）；此时仅将观测到路标点的图像帧索引递减
+            it.start_frame--;
         else  //第一次观测到路标点的图像帧将被删除
         {
-            it->feature_per_frame.erase(it->feature_per_frame.begin());
-            if (it->feature_per_frame.size() == 0)
-                feature.erase(it);
+            it.feature_per_frame.pop_front();
+            if (it.feature_per_frame.size() == 0)
+                return true;
         }
-    }
+        return false;
+    });
 }
 
 void FeatureManager::removeFront(int frame_count)
 {
-    for (auto it = feature.begin(), it_next = feature.begin(); it != feature.end(); it = it_next)
+    compactFeatures([&](FeaturePerId &it_per_id)
     {
-        it_next++;
-
+        FeaturePerId *it = &it_per_id;
         if (it->start_frame == frame_count)  //第一次观测到路标点的图像帧索引为WINDOW_SIZE，路标点的起始观测索引递减
         {
             it->start_frame--;
@@ -546,17 +712,18 @@ void FeatureManager::removeFront(int frame_count)
         {
             int j = WINDOW_SIZE - 1 - it->start_frame;
             if (it->endFrame() < frame_count - 1)  //路标点在被边缘化的图像帧（WINDOW_SIZE-1）和滑窗中最后的图像帧（WINDOW_SIZE）中未被观测
-                continue;
-            it->feature_per_frame.erase(it->feature_per_frame.begin() + j);  //剔除观测到路标点的图像帧中即将被边缘化的图像帧（即WINDOW_SIZE-1）
+                return false;
+            it->feature_per_frame.erase(j);  //剔除观测到路标点的图像帧中即将被边缘化的图像帧（即WINDOW_SIZE-1）
                                                                             //相当于直接丢掉了被边缘化图像帧的观测
             if (it->feature_per_frame.size() == 0)
-                feature.erase(it);
+                return true;
             //TODO(tzhang):BUG若路标点的第一次观测图像帧恰好为被边缘化的图像帧（WINDOW_SIZE-1），并且还被图像帧（WINDOW_SIZE）观测到，没有进行shift depth的处理？？
         }
-    }
+        return false;
+    });
 }
 
-double FeatureManager::compensatedParallax2(const FeaturePerId &it_per_id, int frame_count)
+double FeatureManager::compensatedParallax2(const FeaturePerId &it_per_id, int frame_count, const Matrix3d *R_comp)
 {
     //check the second last frame is keyframe or not
     //parallax betwwen seconde last frame and third last frame
@@ -564,18 +731,21 @@ double FeatureManager::compensatedParallax2(const FeaturePerId &it_per_id, int f
     const FeaturePerFrame &frame_j = it_per_id.feature_per_frame[frame_count - 1 - it_per_id.start_frame];
 
     double ans = 0;
-    Vector3d p_j = frame_j.point;
+    Vector3d p_j = frame_j.point();
 
     double u_j = p_j(0);
     double v_j = p_j(1);
 
-    Vector3d p_i = frame_i.point;
+    Vector3d p_i = frame_i.point();
     Vector3d p_i_comp;
 
     //int r_i = frame_count - 2;
     //int r_j = frame_count - 1;
     //p_i_comp = ric[camera_id_j].transpose() * Rs[r_j].transpose() * Rs[r_i] * ric[camera_id_i] * p_i;
-    p_i_comp = p_i;  
+    if (R_comp)  //将第i帧的观测旋转到第j帧，剩下的视差只由平移引起
+        p_i_comp = (*R_comp) * p_i;
+    else
+        p_i_comp = p_i;  
     double dep_i = p_i(2);
     double u_i = p_i(0) / dep_i;
     double v_i = p_i(1) / dep_i;
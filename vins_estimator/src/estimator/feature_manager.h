@@ -11,6 +11,7 @@
 #define FEATURE_MANAGER_H
 
 #include <list>
+#include <unordered_map>
 #include <algorithm>
 #include <vector>
 #include <numeric>
@@ -24,46 +25,108 @@ using namespace Eigen;
 
 #include "parameters.h"
 #include "../utility/tic_toc.h"
+#include "../utility/thread_pool.h"
+#include "local_map.h"
 
-class FeaturePerFrame  //路标点j图像帧时刻i时刻的特征点信息
+class FeaturePerFrame  //路标点j图像帧时刻i时刻的特征点信息，以float紧凑存储，通过访问函数以double取出
 {
   public:
+    FeaturePerFrame()
+    {
+    }
     FeaturePerFrame(const Eigen::Matrix<double, 7, 1> &_point, double td)
     {
-        point.x() = _point(0);
-        point.y() = _point(1);
-        point.z() = _point(2);
-        uv.x() = _point(3);
-        uv.y() = _point(4);
-        velocity.x() = _point(5); 
-        velocity.y() = _point(6); 
+        Map<Matrix<float, 7, 1>> obs(left);
+        obs = _point.cast<float>();
         cur_td = td;
         is_stereo = false;
     }
     void rightObservation(const Eigen::Matrix<double, 7, 1> &_point)
     {
-        pointRight.x() = _point(0);
-        pointRight.y() = _point(1);
-        pointRight.z() = _point(2);
-        uvRight.x() = _point(3);
-        uvRight.y() = _point(4);
-        velocityRight.x() = _point(5); 
-        velocityRight.y() = _point(6); 
+        Map<Matrix<float, 7, 1>> obs(right);
+        obs = _point.cast<float>();
         is_stereo = true;
     }
-    double cur_td;
-    Vector3d point, pointRight;  //路标点在左相机、右相机的归一化相机坐标系下的位置坐标
-    Vector2d uv, uvRight;  //路标点在左相机、右相机的图像坐标系下的位置（去畸变的位置坐标）
-    Vector2d velocity, velocityRight;  //路标点在左相机、右相机的归一化相机坐标系下的速度
+    Vector3d point() const { return Vector3d(left[0], left[1], left[2]); }  //路标点在左相机的归一化相机坐标系下的位置坐标
+    Vector3d pointRight() const { return Vector3d(right[0], right[1], right[2]); }
+    Vector2d uv() const { return Vector2d(left[3], left[4]); }  //路标点在左相机的图像坐标系下的位置（去畸变的位置坐标）
+    Vector2d uvRight() const { return Vector2d(right[3], right[4]); }
+    Vector2d velocity() const { return Vector2d(left[5], left[6]); }  //路标点在左相机的归一化相机坐标系下的速度
+    Vector2d velocityRight() const { return Vector2d(right[5], right[6]); }
+
+    float left[7], right[7];  //左、右相机观测：归一化坐标x y z，图像坐标u v，速度vx vy
+    float cur_td;
     bool is_stereo;
 };
 
+// 路标点在滑窗内各帧的观测：容量为WINDOW_SIZE+1的环形缓冲，随FeaturePerId内联存放在feature的连续存储中，
+// 删除最早的观测只需移动起点
+class FeatureObservations
+{
+  public:
+    static const int CAPACITY = WINDOW_SIZE + 1;
+
+    template <typename Ring, typename T>
+    class Iterator
+    {
+      public:
+        Iterator(Ring *_ring, int _i) : ring(_ring), i(_i) {}
+        T &operator*() const { return (*ring)[i]; }
+        T *operator->() const { return &(*ring)[i]; }
+        Iterator &operator++() { i++; return *this; }
+        bool operator!=(const Iterator &other) const { return i != other.i; }
+        bool operator==(const Iterator &other) const { return i == other.i; }
+
+      private:
+        Ring *ring;
+        int i;
+    };
+    typedef Iterator<FeatureObservations, FeaturePerFrame> iterator;
+    typedef Iterator<const FeatureObservations, const FeaturePerFrame> const_iterator;
+
+    FeatureObservations() : head(0), count(0) {}
+
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    FeaturePerFrame &operator[](int i) { return data[wrap(head + i)]; }
+    const FeaturePerFrame &operator[](int i) const { return data[wrap(head + i)]; }
+    FeaturePerFrame &back() { return (*this)[count - 1]; }
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, count); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+
+    void push_back(const FeaturePerFrame &f)
+    {
+        ROS_ASSERT(count < CAPACITY);
+        data[wrap(head + count)] = f;
+        count++;
+    }
+    void pop_front()
+    {
+        head = wrap(head + 1);
+        count--;
+    }
+    void erase(int i)  //删除第i个观测，其后的观测前移（只用于删除靠后的观测）
+    {
+        for (int k = i; k + 1 < count; k++)
+            (*this)[k] = (*this)[k + 1];
+        count--;
+    }
+
+  private:
+    static int wrap(int i) { return i >= CAPACITY ? i - CAPACITY : i; }
+
+    FeaturePerFrame data[CAPACITY];
+    int head, count;
+};
+
 class FeaturePerId  // 路标点j在所有观测到该路标点的图像帧上的特征点信息
 {
   public:
-    const int feature_id;
+    int feature_id;  //路标点ID，在FeatureManager中作为稳定的句柄（存储位置会因压缩而变化）
     int start_frame;
-    vector<FeaturePerFrame> feature_per_frame;
+    FeatureObservations feature_per_frame;
     int used_num;
     double estimated_depth;
     int solve_flag; // 0 haven't solve yet; 1 solve succ; 2 solve fail;
@@ -77,15 +140,32 @@ class FeaturePerId  // 路标点j在所有观测到该路标点的图像帧上
     int endFrame();
 };
 
+struct FeatureManagerState  // FeatureManager中可回滚的状态，用于估计器的状态快照
+{
+    vector<FeaturePerId> feature;
+    unordered_map<int, int> feature_slot;
+    vector<int> prev_frame_ids;
+    int last_track_num;
+    double last_average_parallax;
+    int new_feature_num;
+    int long_track_num;
+    int long_feature_num;
+};
+
 class FeatureManager  // 管理所有路标点信息
 {
   public:
     FeatureManager(Matrix3d _Rs[]);
 
     void setRic(Matrix3d _ric[]);
+    void setThreadPool(ThreadPool *_thread_pool);
+    void setLocalMap(LocalMap *_local_map);
     void clearState();
+    void saveState(FeatureManagerState &state) const;
+    void restoreState(const FeatureManagerState &state);
     int getFeatureCount();
-    bool addFeatureCheckParallax(int frame_count, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, double td);
+    bool addFeatureCheckParallax(int frame_count, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, double td,
+                                 const Matrix3d *delta_R = nullptr);
     vector<pair<Vector3d, Vector3d>> getCorresponding(int frame_count_l, int frame_count_r);
     //void updateDepth(const VectorXd &x);
     void setDepth(const VectorXd &x);
@@ -95,23 +175,39 @@ class FeatureManager  // 管理所有路标点信息
     void triangulate(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[]);
     void triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen::Matrix<double, 3, 4> &Pose1,
                             Eigen::Vector2d &point0, Eigen::Vector2d &point1, Eigen::Vector3d &point_3d);
+    static void addDLTConstraint(Eigen::Matrix4d &AtA, const Eigen::Matrix<double, 3, 4> &P, const Eigen::Vector3d &f);
+    static Eigen::Vector4d solveDLT(const Eigen::Matrix4d &AtA);
     void initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[]);
     bool solvePoseByPnP(Eigen::Matrix3d &R_initial, Eigen::Vector3d &P_initial, 
                             vector<cv::Point2f> &pts2D, vector<cv::Point3f> &pts3D);
+    bool solvePoseByGaussNewton(Eigen::Matrix3d &R, Eigen::Vector3d &P,
+                                const vector<Eigen::Vector3d> &pts2D, const vector<Eigen::Vector3d> &pts3D);
     void removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3d marg_P, Eigen::Matrix3d new_R, Eigen::Vector3d new_P);
     void removeBack();
     void removeFront(int frame_count);
     void removeOutlier(set<int> &outlierIndex);
-    list<FeaturePerId> feature; //滑窗内所有的路标点
+    vector<FeaturePerId> feature; //滑窗内所有的路标点，连续存储，删除时保持相对顺序压缩
+    unordered_map<int, int> feature_slot;  //<路标点ID, 在feature中的位置>
     int last_track_num;
     double last_average_parallax;
     int new_feature_num;
     int long_track_num;
 
   private:
-    double compensatedParallax2(const FeaturePerId &it_per_id, int frame_count);
+    template <typename Func>
+    void compactFeatures(Func func);
+    void triangulateFeature(FeaturePerId &it_per_id, const Eigen::Matrix<double, 3, 4> pose[][WINDOW_SIZE + 1],
+                            Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[]);
+    bool matchLocalMap(FeaturePerId &it_per_id, const Eigen::Matrix<double, 3, 4> pose[][WINDOW_SIZE + 1]);
+    double compensatedParallax2(const FeaturePerId &it_per_id, int frame_count, const Matrix3d *R_comp);
     const Matrix3d *Rs;
     Matrix3d ric[2];
+    int long_feature_num;  //观测次数不少于4次的路标点数目，随feature的增删维护
+    ThreadPool *thread_pool;  //三角化所用的线程池，为空时串行
+    LocalMap *local_map;  //滑窗外路标点的局部地图，为空时不启用
+    vector<int> map_candidates;  //局部地图中沿光线的候选点，逐点复用
+    vector<Eigen::Vector3d> pnp_pts2d, pnp_pts3d;  //PnP的2D（归一化坐标）-3D点对，逐帧复用
+    vector<int> prev_frame_ids, cur_frame_ids;  //上一帧、当前帧观测到的路标点ID，用于视差计算
 };
 
 #endif
@@ -0,0 +1,157 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "local_map.h"
+#include <cmath>
+#include <limits>
+
+LocalMap::LocalMap() : voxel_size(0.2), radius(20.0), num_points(0)
+{
+}
+
+void LocalMap::setParameters(double _voxel_size, double _radius)
+{
+    if (_voxel_size > 0)
+        voxel_size = _voxel_size;
+    if (_radius > 0)
+        radius = _radius;
+    clear();
+}
+
+void LocalMap::clear()
+{
+    points.clear();
+    free_slots.clear();
+    voxels.clear();
+    num_points = 0;
+}
+
+// 体素整数坐标各取21位拼成64位索引
+long long LocalMap::voxelKey(const long long c[3]) const
+{
+    long long key = 0;
+    for (int i = 0; i < 3; i++)
+        key = (key << 21) | (c[i] & 0x1FFFFF);
+    return key;
+}
+
+void LocalMap::insert(const Eigen::Vector3d &pos)
+{
+    int slot;
+    if (free_slots.empty())
+    {
+        slot = points.size();
+        points.push_back(MapPoint());
+    }
+    else
+    {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+    long long c[3];
+    for (int i = 0; i < 3; i++)
+        c[i] = static_cast<long long>(std::floor(pos(i) / voxel_size));
+    MapPoint &point = points[slot];
+    point.pos = pos;
+    point.voxel = voxelKey(c);
+    Voxel &voxel = voxels[point.voxel];
+    if (voxel.slots.empty())
+        voxel.center = (Eigen::Vector3d(c[0], c[1], c[2]) + Eigen::Vector3d::Constant(0.5)) * voxel_size;
+    voxel.slots.push_back(slot);
+    num_points++;
+}
+
+// 按体素逐个步进（3D-DDA）：每次跨过离起点最近的体素边界，遍历光线在[0, radius]内经过的所有体素
+void LocalMap::queryRay(const Eigen::Vector3d &origin, const Eigen::Vector3d &dir, std::vector<int> &slots) const
+{
+    slots.clear();
+    if (voxels.empty())
+        return;
+    long long c[3];
+    int step[3];
+    double t_max[3], t_delta[3];
+    for (int i = 0; i < 3; i++)
+    {
+        c[i] = static_cast<long long>(std::floor(origin(i) / voxel_size));
+        if (dir(i) > 0)
+        {
+            step[i] = 1;
+            t_max[i] = ((c[i] + 1) * voxel_size - origin(i)) / dir(i);
+            t_delta[i] = voxel_size / dir(i);
+        }
+        else if (dir(i) < 0)
+        {
+            step[i] = -1;
+            t_max[i] = (c[i] * voxel_size - origin(i)) / dir(i);
+            t_delta[i] = -voxel_size / dir(i);
+        }
+        else
+        {
+            step[i] = 0;
+            t_max[i] = t_delta[i] = std::numeric_limits<double>::infinity();
+        }
+    }
+
+    double t = 0;
+    while (t <= radius)
+    {
+        auto it = voxels.find(voxelKey(c));
+        if (it != voxels.end())
+            slots.insert(slots.end(), it->second.slots.begin(), it->second.slots.end());
+        int i = t_max[0] < t_max[1] ? (t_max[0] < t_max[2] ? 0 : 2) : (t_max[1] < t_max[2] ? 1 : 2);
+        t = t_max[i];
+        c[i] += step[i];
+        t_max[i] += t_delta[i];
+    }
+}
+
+const Eigen::Vector3d &LocalMap::position(int slot) const
+{
+    return points[slot].pos;
+}
+
+void LocalMap::erase(int slot)
+{
+    auto it = voxels.find(points[slot].voxel);
+    std::vector<int> &slots = it->second.slots;
+    for (int k = 0; k < (int)slots.size(); k++)
+    {
+        if (slots[k] == slot)
+        {
+            slots[k] = slots.back();
+            slots.pop_back();
+            break;
+        }
+    }
+    if (slots.empty())
+        voxels.erase(it);
+    free_slots.push_back(slot);
+    num_points--;
+}
+
+void LocalMap::prune(const Eigen::Vector3d &center)
+{
+    double half_diagonal = 0.5 * std::sqrt(3.0) * voxel_size;
+    for (auto it = voxels.begin(); it != voxels.end();)
+    {
+        if ((it->second.center - center).norm() - half_diagonal > radius)
+        {
+            free_slots.insert(free_slots.end(), it->second.slots.begin(), it->second.slots.end());
+            num_points -= it->second.slots.size();
+            it = voxels.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+int LocalMap::size() const
+{
+    return num_points;
+}
@@ -0,0 +1,51 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <eigen3/Eigen/Dense>
+
+// 滑窗外路标点的局部地图：保存锚定帧被边缘化时被丢弃的路标点的世界坐标，按体素哈希组织。
+// 前端对丢失后重新检测到的点会分配新的ID，因此按空间关联：沿新路标点的观测光线遍历体素取候选点，由调用者按重投影误差筛选
+class LocalMap
+{
+  public:
+    LocalMap();
+
+    void setParameters(double _voxel_size, double _radius);
+    void clear();
+    void insert(const Eigen::Vector3d &pos);
+    void queryRay(const Eigen::Vector3d &origin, const Eigen::Vector3d &dir, std::vector<int> &slots) const;  //光线（dir为单位向量）在radius范围内经过的体素中的点
+    const Eigen::Vector3d &position(int slot) const;
+    void erase(int slot);  //被重新观测的点移出地图
+    void prune(const Eigen::Vector3d &center);  //删除与center距离超过radius的体素及其中的点
+    int size() const;
+
+  private:
+    struct MapPoint
+    {
+        Eigen::Vector3d pos;
+        long long voxel;
+    };
+    struct Voxel
+    {
+        Eigen::Vector3d center;
+        std::vector<int> slots;  //体素内的点在points中的位置
+    };
+
+    long long voxelKey(const long long c[3]) const;
+
+    double voxel_size, radius;
+    int num_points;
+    std::vector<MapPoint> points;
+    std::vector<int> free_slots;  //points中空闲的位置
+    std::unordered_map<long long, Voxel> voxels;  //<体素索引, 体素>
+};
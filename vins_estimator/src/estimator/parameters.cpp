@@ -8,9 +8,18 @@
  *******************************************************/
 
 #include "parameters.h"
+#include <thread>
 
 double INIT_DEPTH;
 double MIN_PARALLAX;
+int PARALLAX_ROT_COMP;
+int LOCAL_MAP;
+double LOCAL_MAP_VOXEL_SIZE;
+double LOCAL_MAP_RADIUS;
+double LOCAL_MAP_MATCH_GATE;
+int FAILURE_DETECTION;
+int SNAPSHOT_INTERVAL;
+int STEREO_INIT_FRAMES;
 double ACC_N, ACC_W;
 double GYR_N, GYR_W;
 
@@ -36,6 +45,7 @@ int NUM_OF_CAM;
 int STEREO;
 int USE_IMU;
 int MULTIPLE_THREAD;
+int BACKEND_THREADS;
 map<int, Eigen::Vector3d> pts_gt;
 std::string IMAGE0_TOPIC, IMAGE1_TOPIC;
 std::string FISHEYE_MASK;
@@ -88,6 +98,9 @@ void readParameters(std::string config_file)
     FLOW_BACK = fsSettings["flow_back"];
 
     MULTIPLE_THREAD = fsSettings["multiple_thread"];
+    BACKEND_THREADS = fsSettings["backend_threads"];  //后端并行计算使用的线程数，未设置时根据CPU核数确定
+    if (BACKEND_THREADS <= 0)
+        BACKEND_THREADS = std::max(1, std::min(4, (int)std::thread::hardware_concurrency()));
 
     USE_IMU = fsSettings["imu"];
     printf("USE_IMU: %d\n", USE_IMU);
@@ -106,6 +119,27 @@ void readParameters(std::string config_file)
     NUM_ITERATIONS = fsSettings["max_num_iterations"];
     MIN_PARALLAX = fsSettings["keyframe_parallax"];
     MIN_PARALLAX = MIN_PARALLAX / FOCAL_LENGTH;
+    PARALLAX_ROT_COMP = fsSettings["parallax_rotation_compensation"];  //关键帧判断时是否用陀螺仪积分的旋转补偿视差
+    if (PARALLAX_ROT_COMP && !USE_IMU)  //旋转由陀螺仪积分得到，无IMU时不起作用
+    {
+        ROS_WARN("parallax_rotation_compensation requires imu, ignored");
+        PARALLAX_ROT_COMP = 0;
+    }
+    LOCAL_MAP = fsSettings["local_map"];  //是否保留滑窗外的路标点，与重新检测到的点关联后作为其坐标
+    LOCAL_MAP_VOXEL_SIZE = fsSettings["local_map_voxel_size"];
+    LOCAL_MAP_RADIUS = fsSettings["local_map_radius"];
+    LOCAL_MAP_MATCH_GATE = fsSettings["local_map_match_gate"];  //新路标点与地图点关联的重投影误差阈值（像素）
+    STEREO_INIT_FRAMES = fsSettings["stereo_init_frames"];  //双目+IMU在滑窗中有多少帧后开始对准，未设置时为滑窗满
+    if (STEREO_INIT_FRAMES <= 0 || STEREO_INIT_FRAMES > WINDOW_SIZE + 1)
+        STEREO_INIT_FRAMES = WINDOW_SIZE + 1;
+    STEREO_INIT_FRAMES = std::max(STEREO_INIT_FRAMES, 3);  //速度与重力可解至少需要3帧
+    FAILURE_DETECTION = fsSettings["failure_detection"];  //是否启用failureDetection中的零偏、平移检测
+    SNAPSHOT_INTERVAL = fsSettings["snapshot_interval"];  //每隔多少帧保存一次滑窗状态快照，故障时回滚；0表示不保存
+    if (SNAPSHOT_INTERVAL > 0 && !FAILURE_DETECTION)  //不检测故障时快照不会被使用
+    {
+        ROS_WARN("snapshot_interval requires failure_detection, snapshots disabled");
+        SNAPSHOT_INTERVAL = 0;
+    }
 
     fsSettings["output_path"] >> OUTPUT_FOLDER;
     VINS_RESULT_PATH = OUTPUT_FOLDER + "/vio.csv";
@@ -176,7 +210,7 @@ void readParameters(std::string config_file)
 
     INIT_DEPTH = 5.0;
     BIAS_ACC_THRESHOLD = 0.1;
-    BIAS_GYR_THRESHOLD = 0.1;
+    BIAS_GYR_THRESHOLD = 0.01;  //陀螺零偏变化小于该值时一阶修正与重新积分的差异可忽略
 
     TD = fsSettings["td"];
     ESTIMATE_TD = fsSettings["estimate_td"];
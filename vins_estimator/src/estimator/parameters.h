@@ -22,11 +22,27 @@ using namespace std;
 
 const double FOCAL_LENGTH = 460.0;
 const int WINDOW_SIZE = 10;
-const int NUM_OF_F = 1000;
+const int MAX_IMAGE_FRAMES = 2 * (WINDOW_SIZE + 1);  //初始化阶段all_image_frame最多保存的图像帧数
+const int REPROJ_HIST_BINS = 20;  //重投影误差直方图的区间数，每个区间0.5像素，最后一个区间包含所有更大的误差
 //#define UNIT_SPHERE_ERROR
+//#define VISUAL_FLOAT_RESIDUAL
+
+#ifdef VISUAL_FLOAT_RESIDUAL
+typedef float VisualScalar;  // 视觉重投影残差及雅克比以单精度计算
+#else
+typedef double VisualScalar;
+#endif
 
 extern double INIT_DEPTH;
 extern double MIN_PARALLAX;
+extern int PARALLAX_ROT_COMP;
+extern int LOCAL_MAP;
+extern double LOCAL_MAP_VOXEL_SIZE;
+extern double LOCAL_MAP_RADIUS;
+extern double LOCAL_MAP_MATCH_GATE;
+extern int FAILURE_DETECTION;
+extern int SNAPSHOT_INTERVAL;
+extern int STEREO_INIT_FRAMES;
 extern int ESTIMATE_EXTRINSIC;
 
 extern double ACC_N, ACC_W;
@@ -36,7 +52,7 @@ extern std::vector<Eigen::Matrix3d> RIC;
 extern std::vector<Eigen::Vector3d> TIC;
 extern Eigen::Vector3d G;
 
-extern double BIAS_ACC_THRESHOLD;  //这两个阈值的作用还不是很清楚 tzhang 2019.9.29
+extern double BIAS_ACC_THRESHOLD;  //bias变化超过该阈值时预积分需要重新积分，否则按一阶雅克比修正
 extern double BIAS_GYR_THRESHOLD;
 extern double SOLVER_TIME;
 extern int NUM_ITERATIONS;
@@ -52,6 +68,7 @@ extern int NUM_OF_CAM;
 extern int STEREO;
 extern int USE_IMU;
 extern int MULTIPLE_THREAD;
+extern int BACKEND_THREADS;
 // pts_gt for debug purpose;
 extern map<int, Eigen::Vector3d> pts_gt;
 
@@ -0,0 +1,87 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+struct ImuSample
+{
+    double dt;
+    Eigen::Vector3d acc;
+    Eigen::Vector3d gyr;
+};
+
+/**滑窗共享的IMU数据存储：按到达顺序连续存放，用单调递增的全局下标访问。
+ * 各预积分只记录自己的下标区间[begin, end)，相邻区间合并时无需拷贝数据
+**/
+class ImuSampleArena
+{
+  public:
+    ImuSampleArena() : base(0), first(0)
+    {
+    }
+
+    void reserve(size_t n)
+    {
+        samples.reserve(n);
+    }
+
+    size_t push_back(double dt, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+    {
+        samples.push_back(ImuSample{dt, acc, gyr});
+        return base + samples.size() - 1;
+    }
+
+    const ImuSample &operator[](size_t index) const
+    {
+        return samples[index - base];
+    }
+
+    // 第一个仍然有效的下标
+    size_t beginIndex() const
+    {
+        return base + first;
+    }
+
+    // 下一个写入数据的下标
+    size_t endIndex() const
+    {
+        return base + samples.size();
+    }
+
+    // 丢弃下标first_live之前的数据；失效前缀超过一半时才整体前移，保持均摊O(1)且不释放容量
+    void trim(size_t first_live)
+    {
+        if (first_live > endIndex())
+            first_live = endIndex();
+        if (first_live <= beginIndex())
+            return;
+        first = first_live - base;
+        if (first * 2 >= samples.size())
+        {
+            samples.erase(samples.begin(), samples.begin() + first);
+            base += first;
+            first = 0;
+        }
+    }
+
+    void clear()
+    {
+        base = endIndex();
+        first = 0;
+        samples.clear();
+    }
+
+  private:
+    size_t base;  //samples[0]对应的全局下标
+    size_t first;  //samples中第一个有效数据的位置
+    std::vector<ImuSample> samples;
+};
@@ -11,20 +11,33 @@
 
 #include "../utility/utility.h"
 #include "../estimator/parameters.h"
+#include "imu_sample_arena.h"
+#include "integration_scheme.h"
 
 #include <ceres/ceres.h>
+#include <atomic>
 using namespace Eigen;
 
-class IntegrationBase
+struct RepropagateStats
+{
+    std::atomic<long> full;  //完整重新积分的次数
+    std::atomic<long> corrected;  //bias变化较小、按一阶雅克比修正的次数
+};
+
+// Scheme为单步积分策略，见integration_scheme.h
+template <typename Scheme>
+class IntegrationBaseT
 {
   public:
-    IntegrationBase() = delete;
-    IntegrationBase(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+    IntegrationBaseT() = delete;
+    IntegrationBaseT(const ImuSampleArena *_arena, const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
                     const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
         : acc_0{_acc_0}, gyr_0{_gyr_0}, linearized_acc{_acc_0}, linearized_gyr{_gyr_0},
-          linearized_ba{_linearized_ba}, linearized_bg{_linearized_bg},
+          linearized_ba{_linearized_ba}, linearized_bg{_linearized_bg}, integrated_ba{_linearized_ba}, integrated_bg{_linearized_bg},
             jacobian{Eigen::Matrix<double, 15, 15>::Identity()}, covariance{Eigen::Matrix<double, 15, 15>::Zero()},
-          sum_dt{0.0}, delta_p{Eigen::Vector3d::Zero()}, delta_q{Eigen::Quaterniond::Identity()}, delta_v{Eigen::Vector3d::Zero()}
+          sum_dt{0.0}, delta_p{Eigen::Vector3d::Zero()}, delta_q{Eigen::Quaterniond::Identity()}, delta_v{Eigen::Vector3d::Zero()},
+          integrated_delta_p{Eigen::Vector3d::Zero()}, integrated_delta_q{Eigen::Quaterniond::Identity()}, integrated_delta_v{Eigen::Vector3d::Zero()},
+          arena{_arena}, sample_begin{0}, sample_end{0}
 
     {
         noise = Eigen::Matrix<double, 18, 18>::Zero();  // 中值积分，噪声项有6项；欧拉积分，噪声项为4项（对应vins-mono论文公式9的nt） tzhang
@@ -36,46 +49,114 @@ class IntegrationBase
         noise.block<3, 3>(15, 15) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
     }
 
-    void push_back(double dt, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+    // 原地重置为新的预积分起点，保留采样缓存的容量以便对象池复用
+    void reset(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+               const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
+    {
+        acc_0 = _acc_0;
+        gyr_0 = _gyr_0;
+        linearized_acc = _acc_0;
+        linearized_gyr = _gyr_0;
+        linearized_ba = _linearized_ba;
+        linearized_bg = _linearized_bg;
+        integrated_ba = _linearized_ba;
+        integrated_bg = _linearized_bg;
+        jacobian.setIdentity();
+        covariance.setZero();
+        sum_dt = 0.0;
+        delta_p.setZero();
+        delta_q.setIdentity();
+        delta_v.setZero();
+        integrated_delta_p.setZero();
+        integrated_delta_q.setIdentity();
+        integrated_delta_v.setZero();
+        sample_begin = 0;
+        sample_end = 0;
+    }
+
+    // 积分arena中下标为index的IMU数据，index须紧接在已有区间之后
+    void push_back(size_t index)
+    {
+        if (sample_begin == sample_end)
+            sample_begin = index;
+        sample_end = index + 1;
+        const ImuSample &s = (*arena)[index];
+        propagate(s.dt, s.acc, s.gyr);
+    }
+
+    // 合并紧随其后的预积分：继续积分其数据并延伸下标区间，数据本身不做拷贝
+    void extend(const IntegrationBaseT &next)
+    {
+        if (next.sample_begin == next.sample_end)
+            return;
+        if (sample_begin == sample_end)
+            sample_begin = next.sample_begin;
+        for (size_t i = next.sample_begin; i < next.sample_end; i++)
+        {
+            const ImuSample &s = (*arena)[i];
+            propagate(s.dt, s.acc, s.gyr);
+        }
+        sample_end = next.sample_end;
+    }
+
+    size_t numSamples() const
     {
-        dt_buf.push_back(dt);
-        acc_buf.push_back(acc);
-        gyr_buf.push_back(gyr);
-        propagate(dt, acc, gyr);
+        return sample_end - sample_begin;
     }
 
+    static RepropagateStats &repropagateStats()
+    {
+        static RepropagateStats stats{{0}, {0}};
+        return stats;
+    }
+
+    /**更新bias线性化点。新bias与实际积分所用的bias（integrated_ba/bg）之差小于BIAS_ACC_THRESHOLD/BIAS_GYR_THRESHOLD时，
+     * 由积分结果按预积分对bias的雅克比做一阶修正，O(1)完成；否则对区间内全部IMU数据重新积分。
+     * 阈值始终相对积分点判断，多次小的更新累积超过阈值时同样会重新积分
+    **/
     void repropagate(const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
     {
+        if ((_linearized_ba - integrated_ba).norm() < BIAS_ACC_THRESHOLD && (_linearized_bg - integrated_bg).norm() < BIAS_GYR_THRESHOLD)
+        {
+            linearized_ba = _linearized_ba;
+            linearized_bg = _linearized_bg;
+            correctBias();
+            repropagateStats().corrected++;
+            return;
+        }
+        repropagateStats().full++;
+
         sum_dt = 0.0;  //再次进行预积分重传播，通常是由于imu的bias发生较大的改变，预积分值不能通过雅克比进行更新，需要重新预积分传播进行更新 tzhang
         acc_0 = linearized_acc;
         gyr_0 = linearized_gyr;
-        delta_p.setZero();
-        delta_q.setIdentity();
-        delta_v.setZero();
+        integrated_delta_p.setZero();
+        integrated_delta_q.setIdentity();
+        integrated_delta_v.setZero();
         linearized_ba = _linearized_ba;
         linearized_bg = _linearized_bg;
+        integrated_ba = _linearized_ba;
+        integrated_bg = _linearized_bg;
         jacobian.setIdentity();
         covariance.setZero();
-        for (int i = 0; i < static_cast<int>(dt_buf.size()); i++)
-            propagate(dt_buf[i], acc_buf[i], gyr_buf[i]);
+        correctBias();
+        for (size_t i = sample_begin; i < sample_end; i++)
+        {
+            const ImuSample &s = (*arena)[i];
+            propagate(s.dt, s.acc, s.gyr);
+        }
     }
 
-    void midPointIntegration(double _dt, 
-                            const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
-                            const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1,
-                            const Eigen::Vector3d &delta_p, const Eigen::Quaterniond &delta_q, const Eigen::Vector3d &delta_v,
-                            const Eigen::Vector3d &linearized_ba, const Eigen::Vector3d &linearized_bg,
-                            Eigen::Vector3d &result_delta_p, Eigen::Quaterniond &result_delta_q, Eigen::Vector3d &result_delta_v,
-                            Eigen::Vector3d &result_linearized_ba, Eigen::Vector3d &result_linearized_bg, bool update_jacobian)
+    void integrationStep(double _dt, 
+                        const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+                        const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1,
+                        const Eigen::Vector3d &delta_p, const Eigen::Quaterniond &delta_q, const Eigen::Vector3d &delta_v,
+                        const Eigen::Vector3d &linearized_ba, const Eigen::Vector3d &linearized_bg,
+                        Eigen::Vector3d &result_delta_p, Eigen::Quaterniond &result_delta_q, Eigen::Vector3d &result_delta_v,
+                        Eigen::Vector3d &result_linearized_ba, Eigen::Vector3d &result_linearized_bg, bool update_jacobian)
     {
-        //ROS_INFO("midpoint integration");  // 注意预积分中，下述中值积分的坐标基准为第k帧图像帧时刻IMU坐标系
-        Vector3d un_acc_0 = delta_q * (_acc_0 - linearized_ba);  //i时刻在第k帧图像帧时刻IMU坐标系下的加速度 tzhang
-        Vector3d un_gyr = 0.5 * (_gyr_0 + _gyr_1) - linearized_bg;
-        result_delta_q = delta_q * Quaterniond(1, un_gyr(0) * _dt / 2, un_gyr(1) * _dt / 2, un_gyr(2) * _dt / 2);  //q= q*dq 中值积分更新四元数 tzhang
-        Vector3d un_acc_1 = result_delta_q * (_acc_1 - linearized_ba);  //i+1时刻在第k帧图像帧时刻IMU坐标系下的加速度 tzhang
-        Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);  // 中值积分更新加速度 tzhang
-        result_delta_p = delta_p + delta_v * _dt + 0.5 * un_acc * _dt * _dt;  // 中值积分更新位置  tzhang
-        result_delta_v = delta_v + un_acc * _dt;  //中值积分更新速度 tzhang
+        // 注意预积分中，积分的坐标基准为第k帧图像帧时刻IMU坐标系；状态按Scheme积分，雅克比与协方差按中值积分线性化
+        Scheme::integrate(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, linearized_ba, linearized_bg,
+                          delta_p, delta_q, delta_v, result_delta_p, result_delta_q, result_delta_v);
         result_linearized_ba = linearized_ba;  //两图像帧之间，IMU bias保持固定 tzhang
         result_linearized_bg = linearized_bg;         
 
@@ -96,46 +177,94 @@ class IntegrationBase
                 a_1_x(2), 0, -a_1_x(0),
                 -a_1_x(1), a_1_x(0), 0;
 
-            MatrixXd F = MatrixXd::Zero(15, 15);  //对应贺博第三讲F矩阵，对应VINS_Mono论文（I+F*dt) tzhang
+            Matrix3d R_0 = delta_q.toRotationMatrix();  //四元数转旋转矩阵只计算一次 tzhang
+            Matrix3d R_1 = result_delta_q.toRotationMatrix();
+            Matrix3d R_1_a_1_x = R_1 * R_a_1_x;
+            Matrix3d R_1_a_1_w = R_1_a_1_x * (Matrix3d::Identity() - R_w_x * _dt);
+            Matrix3d R_0_a_0_x = R_0 * R_a_0_x;
+            double dt2 = _dt * _dt;
+
+            Eigen::Matrix<double, 15, 15> F = Eigen::Matrix<double, 15, 15>::Zero();  //对应贺博第三讲F矩阵，对应VINS_Mono论文（I+F*dt) tzhang
             F.block<3, 3>(0, 0) = Matrix3d::Identity();
-            F.block<3, 3>(0, 3) = -0.25 * delta_q.toRotationMatrix() * R_a_0_x * _dt * _dt + 
-                                  -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt * _dt;
-            F.block<3, 3>(0, 6) = MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(0, 9) = -0.25 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt * _dt;
-            F.block<3, 3>(0, 12) = -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * _dt * -_dt;
+            F.block<3, 3>(0, 3) = -0.25 * R_0_a_0_x * dt2 + -0.25 * R_1_a_1_w * dt2;
+            F.block<3, 3>(0, 6) = Matrix3d::Identity() * _dt;
+            F.block<3, 3>(0, 9) = -0.25 * (R_0 + R_1) * dt2;
+            F.block<3, 3>(0, 12) = -0.25 * R_1_a_1_x * dt2 * -_dt;
             F.block<3, 3>(3, 3) = Matrix3d::Identity() - R_w_x * _dt;
-            F.block<3, 3>(3, 12) = -1.0 * MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(6, 3) = -0.5 * delta_q.toRotationMatrix() * R_a_0_x * _dt + 
-                                  -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt;
+            F.block<3, 3>(3, 12) = -1.0 * Matrix3d::Identity() * _dt;
+            F.block<3, 3>(6, 3) = -0.5 * R_0_a_0_x * _dt + -0.5 * R_1_a_1_w * _dt;
             F.block<3, 3>(6, 6) = Matrix3d::Identity();
-            F.block<3, 3>(6, 9) = -0.5 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt;
-            F.block<3, 3>(6, 12) = -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * -_dt;
+            F.block<3, 3>(6, 9) = -0.5 * (R_0 + R_1) * _dt;
+            F.block<3, 3>(6, 12) = -0.5 * R_1_a_1_x * _dt * -_dt;
             F.block<3, 3>(9, 9) = Matrix3d::Identity();
             F.block<3, 3>(12, 12) = Matrix3d::Identity();
             //cout<<"A"<<endl<<A<<endl;
 
-            MatrixXd V = MatrixXd::Zero(15,18);  //对应贺博第三讲G矩阵，对应VINS_Mono论文 G*dt tzhang
-            V.block<3, 3>(0, 0) =  0.25 * delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 3) =  0.25 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * _dt * 0.5 * _dt;
-            V.block<3, 3>(0, 6) =  0.25 * result_delta_q.toRotationMatrix() * _dt * _dt;
+            Eigen::Matrix<double, 15, 18> V = Eigen::Matrix<double, 15, 18>::Zero();  //对应贺博第三讲G矩阵，对应VINS_Mono论文 G*dt tzhang
+            V.block<3, 3>(0, 0) =  0.25 * R_0 * dt2;
+            V.block<3, 3>(0, 3) =  0.25 * -R_1_a_1_x * dt2 * 0.5 * _dt;
+            V.block<3, 3>(0, 6) =  0.25 * R_1 * dt2;
             V.block<3, 3>(0, 9) =  V.block<3, 3>(0, 3);
-            V.block<3, 3>(3, 3) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(3, 9) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(6, 0) =  0.5 * delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 3) =  0.5 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * 0.5 * _dt;
-            V.block<3, 3>(6, 6) =  0.5 * result_delta_q.toRotationMatrix() * _dt;
+            V.block<3, 3>(3, 3) =  0.5 * Matrix3d::Identity() * _dt;
+            V.block<3, 3>(3, 9) =  0.5 * Matrix3d::Identity() * _dt;
+            V.block<3, 3>(6, 0) =  0.5 * R_0 * _dt;
+            V.block<3, 3>(6, 3) =  0.5 * -R_1_a_1_x * _dt * 0.5 * _dt;
+            V.block<3, 3>(6, 6) =  0.5 * R_1 * _dt;
             V.block<3, 3>(6, 9) =  V.block<3, 3>(6, 3);
-            V.block<3, 3>(9, 12) = MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(12, 15) = MatrixXd::Identity(3,3) * _dt;
+            V.block<3, 3>(9, 12) = Matrix3d::Identity() * _dt;
+            V.block<3, 3>(12, 15) = Matrix3d::Identity() * _dt;
 
             //step_jacobian = F;
             //step_V = V;
-            jacobian = F * jacobian; //对应 VINS_Mono公式11，即雅克比矩阵的迭代更新计算 tzhang
-            covariance = F * covariance * F.transpose() + V * noise * V.transpose();  //协方差传播 tzhang
+            jacobian = sparseF(F, jacobian); //对应 VINS_Mono公式11，即雅克比矩阵的迭代更新计算 tzhang
+            Eigen::Matrix<double, 15, 15> FP = sparseF(F, covariance);  //协方差传播 F*P*F^T + V*N*V^T，F*P*F^T对称，等于F*(F*P)^T tzhang
+            covariance = sparseF(F, FP.transpose());
+            addSparseVNV(V, covariance);
         }
 
     }
 
+    // 按F的非零块计算F*M，3x3块意义下F仅有(0,0)(0,1)(0,2)(0,3)(0,4)(1,1)(1,4)(2,1)(2,2)(2,3)(2,4)(3,3)(4,4)非零
+    static Eigen::Matrix<double, 15, 15> sparseF(const Eigen::Matrix<double, 15, 15> &F, const Eigen::Matrix<double, 15, 15> &M)
+    {
+        Eigen::Matrix<double, 15, 15> R;
+        R.block<3, 15>(0, 0) = M.block<3, 15>(0, 0) + F.block<3, 3>(0, 3) * M.block<3, 15>(3, 0) + F.block<3, 3>(0, 6) * M.block<3, 15>(6, 0)
+                             + F.block<3, 3>(0, 9) * M.block<3, 15>(9, 0) + F.block<3, 3>(0, 12) * M.block<3, 15>(12, 0);
+        R.block<3, 15>(3, 0) = F.block<3, 3>(3, 3) * M.block<3, 15>(3, 0) + F.block<3, 3>(3, 12) * M.block<3, 15>(12, 0);
+        R.block<3, 15>(6, 0) = F.block<3, 3>(6, 3) * M.block<3, 15>(3, 0) + M.block<3, 15>(6, 0)
+                             + F.block<3, 3>(6, 9) * M.block<3, 15>(9, 0) + F.block<3, 3>(6, 12) * M.block<3, 15>(12, 0);
+        R.block<6, 15>(9, 0) = M.block<6, 15>(9, 0);
+        return R;
+    }
+
+    // P += V*N*V^T，只累加V的非零块；noise的对角块均为标量乘单位阵
+    void addSparseVNV(const Eigen::Matrix<double, 15, 18> &V, Eigen::Matrix<double, 15, 15> &P) const
+    {
+        static const bool nz[5][6] = {{true, true, true, true, false, false},
+                                      {false, true, false, true, false, false},
+                                      {true, true, true, true, false, false},
+                                      {false, false, false, false, true, false},
+                                      {false, false, false, false, false, true}};
+        for (int i = 0; i < 5; i++)
+            for (int j = i; j < 5; j++)
+            {
+                Eigen::Matrix3d Q = Eigen::Matrix3d::Zero();
+                bool used = false;
+                for (int k = 0; k < 6; k++)
+                {
+                    if (!nz[i][k] || !nz[j][k])
+                        continue;
+                    Q += noise(3 * k, 3 * k) * V.block<3, 3>(3 * i, 3 * k) * V.block<3, 3>(3 * j, 3 * k).transpose();
+                    used = true;
+                }
+                if (!used)
+                    continue;
+                P.block<3, 3>(3 * i, 3 * j) += Q;
+                if (i != j)
+                    P.block<3, 3>(3 * j, 3 * i) += Q.transpose();
+            }
+    }
+
     void propagate(double _dt, const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1)
     {
         dt = _dt;
@@ -147,25 +276,42 @@ class IntegrationBase
         Vector3d result_linearized_ba;
         Vector3d result_linearized_bg;
 
-        midPointIntegration(_dt, acc_0, gyr_0, _acc_1, _gyr_1, delta_p, delta_q, delta_v,
-                            linearized_ba, linearized_bg,
-                            result_delta_p, result_delta_q, result_delta_v,
-                            result_linearized_ba, result_linearized_bg, 1);
+        integrationStep(_dt, acc_0, gyr_0, _acc_1, _gyr_1, integrated_delta_p, integrated_delta_q, integrated_delta_v,
+                        integrated_ba, integrated_bg,
+                        result_delta_p, result_delta_q, result_delta_v,
+                        result_linearized_ba, result_linearized_bg, 1);
 
         //checkJacobian(_dt, acc_0, gyr_0, acc_1, gyr_1, delta_p, delta_q, delta_v,
         //                    linearized_ba, linearized_bg);
-        delta_p = result_delta_p;
-        delta_q = result_delta_q;
-        delta_v = result_delta_v;
-        linearized_ba = result_linearized_ba;
-        linearized_bg = result_linearized_bg;
-        delta_q.normalize();
+        integrated_delta_p = result_delta_p;
+        integrated_delta_q = result_delta_q;
+        integrated_delta_v = result_delta_v;
+        integrated_delta_q.normalize();
+        correctBias();
         sum_dt += dt;
         acc_0 = acc_1;
         gyr_0 = gyr_1;
      
     }
 
+    // delta_p/q/v = 积分结果在linearized_ba/bg处的一阶修正；线性化点即积分点时直接取积分结果
+    void correctBias()
+    {
+        if (linearized_ba == integrated_ba && linearized_bg == integrated_bg)
+        {
+            delta_p = integrated_delta_p;
+            delta_q = integrated_delta_q;
+            delta_v = integrated_delta_v;
+            return;
+        }
+        Eigen::Vector3d dba = linearized_ba - integrated_ba;
+        Eigen::Vector3d dbg = linearized_bg - integrated_bg;
+        delta_q = integrated_delta_q * Utility::deltaQ(jacobian.block<3, 3>(O_R, O_BG) * dbg);
+        delta_q.normalize();
+        delta_v = integrated_delta_v + jacobian.block<3, 3>(O_V, O_BA) * dba + jacobian.block<3, 3>(O_V, O_BG) * dbg;
+        delta_p = integrated_delta_p + jacobian.block<3, 3>(O_P, O_BA) * dba + jacobian.block<3, 3>(O_P, O_BG) * dbg;
+    }
+
     Eigen::Matrix<double, 15, 1> evaluate(const Eigen::Vector3d &Pi, const Eigen::Quaterniond &Qi, const Eigen::Vector3d &Vi, const Eigen::Vector3d &Bai, const Eigen::Vector3d &Bgi,
                                           const Eigen::Vector3d &Pj, const Eigen::Quaterniond &Qj, const Eigen::Vector3d &Vj, const Eigen::Vector3d &Baj, const Eigen::Vector3d &Bgj)
     {
@@ -198,8 +344,9 @@ class IntegrationBase
     Eigen::Vector3d acc_0, gyr_0;
     Eigen::Vector3d acc_1, gyr_1;
 
-    const Eigen::Vector3d linearized_acc, linearized_gyr;
-    Eigen::Vector3d linearized_ba, linearized_bg;
+    Eigen::Vector3d linearized_acc, linearized_gyr;
+    Eigen::Vector3d linearized_ba, linearized_bg;  //delta_p/q/v对应的bias
+    Eigen::Vector3d integrated_ba, integrated_bg;  //IMU数据实际积分时使用的bias，jacobian、covariance均在此处线性化
 
     Eigen::Matrix<double, 15, 15> jacobian, covariance;
     Eigen::Matrix<double, 15, 15> step_jacobian;
@@ -210,12 +357,25 @@ class IntegrationBase
     Eigen::Vector3d delta_p;
     Eigen::Quaterniond delta_q;
     Eigen::Vector3d delta_v;
+    Eigen::Vector3d integrated_delta_p;  //以integrated_ba/bg积分的结果
+    Eigen::Quaterniond integrated_delta_q;
+    Eigen::Vector3d integrated_delta_v;
 
-    std::vector<double> dt_buf;
-    std::vector<Eigen::Vector3d> acc_buf;
-    std::vector<Eigen::Vector3d> gyr_buf;
+    const ImuSampleArena *arena;  //IMU数据存放在共享arena中，此处仅记录下标区间[sample_begin, sample_end)
+    size_t sample_begin, sample_end;
 
 };
+
+//#define IMU_INTEGRATION_RK4
+//#define IMU_INTEGRATION_MANIFOLD
+
+#if defined(IMU_INTEGRATION_RK4)
+typedef IntegrationBaseT<RK4Integration> IntegrationBase;
+#elif defined(IMU_INTEGRATION_MANIFOLD)
+typedef IntegrationBaseT<ManifoldIntegration> IntegrationBase;
+#else
+typedef IntegrationBaseT<MidPointIntegration> IntegrationBase;  // 默认中值积分
+#endif
 /*
 
     void eulerIntegration(double _dt, const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
@@ -295,7 +455,7 @@ class IntegrationBase
         Vector3d result_delta_v;
         Vector3d result_linearized_ba;
         Vector3d result_linearized_bg;
-        midPointIntegration(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p, delta_q, delta_v,
+        integrationStep(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p, delta_q, delta_v,
                             linearized_ba, linearized_bg,
                             result_delta_p, result_delta_q, result_delta_v,
                             result_linearized_ba, result_linearized_bg, 0);
@@ -308,7 +468,7 @@ class IntegrationBase
 
         Vector3d turb(0.0001, -0.003, 0.003);
 
-        midPointIntegration(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p + turb, delta_q, delta_v,
+        integrationStep(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p + turb, delta_q, delta_v,
                             linearized_ba, linearized_bg,
                             turb_delta_p, turb_delta_q, turb_delta_v,
                             turb_linearized_ba, turb_linearized_bg, 0);
@@ -324,7 +484,7 @@ class IntegrationBase
         cout << "bg diff " << (turb_linearized_bg - result_linearized_bg).transpose() << endl;
         cout << "bg jacob diff " << (step_jacobian.block<3, 3>(12, 0) * turb).transpose() << endl;
 
-        midPointIntegration(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p, delta_q * Quaterniond(1, turb(0) / 2, turb(1) / 2, turb(2) / 2), delta_v,
+        integrationStep(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p, delta_q * Quaterniond(1, turb(0) / 2, turb(1) / 2, turb(2) / 2), delta_v,
                             linearized_ba, linearized_bg,
                             turb_delta_p, turb_delta_q, turb_delta_v,
                             turb_linearized_ba, turb_linearized_bg, 0);
@@ -340,7 +500,7 @@ class IntegrationBase
         cout << "bg diff      " << (turb_linearized_bg - result_linearized_bg).transpose() << endl;
         cout << "bg jacob diff" << (step_jacobian.block<3, 3>(12, 3) * turb).transpose() << endl;
 
-        midPointIntegration(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p, delta_q, delta_v + turb,
+        integrationStep(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p, delta_q, delta_v + turb,
                             linearized_ba, linearized_bg,
                             turb_delta_p, turb_delta_q, turb_delta_v,
                             turb_linearized_ba, turb_linearized_bg, 0);
@@ -356,7 +516,7 @@ class IntegrationBase
         cout << "bg diff      " << (turb_linearized_bg - result_linearized_bg).transpose() << endl;
         cout << "bg jacob diff" << (step_jacobian.block<3, 3>(12, 6) * turb).transpose() << endl;
 
-        midPointIntegration(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p, delta_q, delta_v,
+        integrationStep(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p, delta_q, delta_v,
                             linearized_ba + turb, linearized_bg,
                             turb_delta_p, turb_delta_q, turb_delta_v,
                             turb_linearized_ba, turb_linearized_bg, 0);
@@ -372,7 +532,7 @@ class IntegrationBase
         cout << "bg diff      " << (turb_linearized_bg - result_linearized_bg).transpose() << endl;
         cout << "bg jacob diff" << (step_jacobian.block<3, 3>(12, 9) * turb).transpose() << endl;
 
-        midPointIntegration(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p, delta_q, delta_v,
+        integrationStep(_dt, _acc_0, _gyr_0, _acc_1, _gyr_1, delta_p, delta_q, delta_v,
                             linearized_ba, linearized_bg + turb,
                             turb_delta_p, turb_delta_q, turb_delta_v,
                             turb_linearized_ba, turb_linearized_bg, 0);
@@ -388,7 +548,7 @@ class IntegrationBase
         cout << "bg diff      " << (turb_linearized_bg - result_linearized_bg).transpose() << endl;
         cout << "bg jacob diff" << (step_jacobian.block<3, 3>(12, 12) * turb).transpose() << endl;
 
-        midPointIntegration(_dt, _acc_0 + turb, _gyr_0, _acc_1 , _gyr_1, delta_p, delta_q, delta_v,
+        integrationStep(_dt, _acc_0 + turb, _gyr_0, _acc_1 , _gyr_1, delta_p, delta_q, delta_v,
                             linearized_ba, linearized_bg,
                             turb_delta_p, turb_delta_q, turb_delta_v,
                             turb_linearized_ba, turb_linearized_bg, 0);
@@ -404,7 +564,7 @@ class IntegrationBase
         cout << "bg diff      " << (turb_linearized_bg - result_linearized_bg).transpose() << endl;
         cout << "bg jacob diff" << (step_V.block<3, 3>(12, 0) * turb).transpose() << endl;
 
-        midPointIntegration(_dt, _acc_0, _gyr_0 + turb, _acc_1 , _gyr_1, delta_p, delta_q, delta_v,
+        integrationStep(_dt, _acc_0, _gyr_0 + turb, _acc_1 , _gyr_1, delta_p, delta_q, delta_v,
                             linearized_ba, linearized_bg,
                             turb_delta_p, turb_delta_q, turb_delta_v,
                             turb_linearized_ba, turb_linearized_bg, 0);
@@ -420,7 +580,7 @@ class IntegrationBase
         cout << "bg diff      " << (turb_linearized_bg - result_linearized_bg).transpose() << endl;
         cout << "bg jacob diff" << (step_V.block<3, 3>(12, 3) * turb).transpose() << endl;
 
-        midPointIntegration(_dt, _acc_0, _gyr_0, _acc_1 + turb, _gyr_1, delta_p, delta_q, delta_v,
+        integrationStep(_dt, _acc_0, _gyr_0, _acc_1 + turb, _gyr_1, delta_p, delta_q, delta_v,
                             linearized_ba, linearized_bg,
                             turb_delta_p, turb_delta_q, turb_delta_v,
                             turb_linearized_ba, turb_linearized_bg, 0);
@@ -436,7 +596,7 @@ class IntegrationBase
         cout << "bg diff      " << (turb_linearized_bg - result_linearized_bg).transpose() << endl;
         cout << "bg jacob diff" << (step_V.block<3, 3>(12, 6) * turb).transpose() << endl;
 
-        midPointIntegration(_dt, _acc_0, _gyr_0, _acc_1 , _gyr_1 + turb, delta_p, delta_q, delta_v,
+        integrationStep(_dt, _acc_0, _gyr_0, _acc_1 , _gyr_1 + turb, delta_p, delta_q, delta_v,
                             linearized_ba, linearized_bg,
                             turb_delta_p, turb_delta_q, turb_delta_v,
                             turb_linearized_ba, turb_linearized_bg, 0);
@@ -0,0 +1,65 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include "integration_base.h"
+
+// IntegrationBase对象池：release的对象放回空闲链表，acquire时原地reset复用，稳态下不再分配堆内存
+class IntegrationPool
+{
+  public:
+    IntegrationPool(const ImuSampleArena *_arena) : arena(_arena)
+    {
+    }
+
+    ~IntegrationPool()
+    {
+        for (IntegrationBase *p : free_list)
+            delete p;
+    }
+
+    // 预先创建n个空闲对象
+    void reserve(int n)
+    {
+        free_list.reserve(n);
+        while (static_cast<int>(free_list.size()) < n)
+        {
+            free_list.push_back(new IntegrationBase{arena, Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero(),
+                                                    Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero()});
+        }
+    }
+
+    IntegrationBase *acquire(const Eigen::Vector3d &acc_0, const Eigen::Vector3d &gyr_0,
+                             const Eigen::Vector3d &linearized_ba, const Eigen::Vector3d &linearized_bg)
+    {
+        if (free_list.empty())
+            return new IntegrationBase{arena, acc_0, gyr_0, linearized_ba, linearized_bg};
+        IntegrationBase *p = free_list.back();
+        free_list.pop_back();
+        p->reset(acc_0, gyr_0, linearized_ba, linearized_bg);
+        return p;
+    }
+
+    void release(IntegrationBase *p)
+    {
+        if (p != nullptr)
+            free_list.push_back(p);
+    }
+
+    int numFree() const
+    {
+        return static_cast<int>(free_list.size());
+    }
+
+  private:
+    const ImuSampleArena *arena;
+    std::vector<IntegrationBase *> free_list;
+};
@@ -0,0 +1,140 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Geometry>
+
+/**预积分单步积分策略，作为IntegrationBaseT的模板参数。
+ * 输入相邻两个IMU数据（已在各策略内部去除bias），由k帧坐标系下的delta_p/q/v积分得到下一时刻的值；
+ * 雅克比与协方差仍按中值积分的线性化传播
+**/
+
+// 中值积分，原有实现
+struct MidPointIntegration
+{
+    static const char *name()
+    {
+        return "midpoint";
+    }
+
+    static void integrate(double _dt,
+                          const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+                          const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1,
+                          const Eigen::Vector3d &linearized_ba, const Eigen::Vector3d &linearized_bg,
+                          const Eigen::Vector3d &delta_p, const Eigen::Quaterniond &delta_q, const Eigen::Vector3d &delta_v,
+                          Eigen::Vector3d &result_delta_p, Eigen::Quaterniond &result_delta_q, Eigen::Vector3d &result_delta_v)
+    {
+        Eigen::Vector3d un_acc_0 = delta_q * (_acc_0 - linearized_ba);  //i时刻在第k帧图像帧时刻IMU坐标系下的加速度 tzhang
+        Eigen::Vector3d un_gyr = 0.5 * (_gyr_0 + _gyr_1) - linearized_bg;
+        result_delta_q = delta_q * Eigen::Quaterniond(1, un_gyr(0) * _dt / 2, un_gyr(1) * _dt / 2, un_gyr(2) * _dt / 2);  //q= q*dq 中值积分更新四元数 tzhang
+        Eigen::Vector3d un_acc_1 = result_delta_q * (_acc_1 - linearized_ba);  //i+1时刻在第k帧图像帧时刻IMU坐标系下的加速度 tzhang
+        Eigen::Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);  // 中值积分更新加速度 tzhang
+        result_delta_p = delta_p + delta_v * _dt + 0.5 * un_acc * _dt * _dt;  // 中值积分更新位置  tzhang
+        result_delta_v = delta_v + un_acc * _dt;  //中值积分更新速度 tzhang
+    }
+};
+
+// 四阶龙格库塔，角速度与加速度在两个IMU数据间线性插值
+struct RK4Integration
+{
+    static const char *name()
+    {
+        return "rk4";
+    }
+
+    static void integrate(double _dt,
+                          const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+                          const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1,
+                          const Eigen::Vector3d &linearized_ba, const Eigen::Vector3d &linearized_bg,
+                          const Eigen::Vector3d &delta_p, const Eigen::Quaterniond &delta_q, const Eigen::Vector3d &delta_v,
+                          Eigen::Vector3d &result_delta_p, Eigen::Quaterniond &result_delta_q, Eigen::Vector3d &result_delta_v)
+    {
+        Eigen::Vector3d a0 = _acc_0 - linearized_ba, a1 = _acc_1 - linearized_ba;
+        Eigen::Vector3d w0 = _gyr_0 - linearized_bg, w1 = _gyr_1 - linearized_bg;
+        Eigen::Vector3d am = 0.5 * (a0 + a1), wm = 0.5 * (w0 + w1);
+        double h = _dt;
+
+        // kq为q*[0,w]（四元数导数的2倍），kv、kp为速度、位置的导数；四元数中间量归一化后再求旋转
+        Eigen::Quaterniond q1 = delta_q;
+        Eigen::Quaterniond kq1 = q1 * Eigen::Quaterniond(0, w0(0), w0(1), w0(2));
+        Eigen::Vector3d kv1 = q1 * a0;
+        Eigen::Vector3d kp1 = delta_v;
+
+        Eigen::Quaterniond q2 = Eigen::Quaterniond(delta_q.coeffs() + 0.25 * h * kq1.coeffs()).normalized();
+        Eigen::Quaterniond kq2 = q2 * Eigen::Quaterniond(0, wm(0), wm(1), wm(2));
+        Eigen::Vector3d kv2 = q2 * am;
+        Eigen::Vector3d kp2 = delta_v + 0.5 * h * kv1;
+
+        Eigen::Quaterniond q3 = Eigen::Quaterniond(delta_q.coeffs() + 0.25 * h * kq2.coeffs()).normalized();
+        Eigen::Quaterniond kq3 = q3 * Eigen::Quaterniond(0, wm(0), wm(1), wm(2));
+        Eigen::Vector3d kv3 = q3 * am;
+        Eigen::Vector3d kp3 = delta_v + 0.5 * h * kv2;
+
+        Eigen::Quaterniond q4 = Eigen::Quaterniond(delta_q.coeffs() + 0.5 * h * kq3.coeffs()).normalized();
+        Eigen::Quaterniond kq4 = q4 * Eigen::Quaterniond(0, w1(0), w1(1), w1(2));
+        Eigen::Vector3d kv4 = q4 * a1;
+        Eigen::Vector3d kp4 = delta_v + h * kv3;
+
+        result_delta_q = Eigen::Quaterniond(delta_q.coeffs() + h / 12.0 * (kq1.coeffs() + 2 * kq2.coeffs() + 2 * kq3.coeffs() + kq4.coeffs()));
+        result_delta_q.normalize();
+        result_delta_v = delta_v + h / 6.0 * (kv1 + 2 * kv2 + 2 * kv3 + kv4);
+        result_delta_p = delta_p + h / 6.0 * (kp1 + 2 * kp2 + 2 * kp3 + kp4);
+    }
+};
+
+/**SO(3)上的积分：角速度线性变化时，旋转用二阶Magnus展开 Exp(w_mean*dt + dt^2/12 * w0 x w1) 精确求指数映射；
+ * 速度、位置对旋转后的加速度做Simpson积分
+**/
+struct ManifoldIntegration
+{
+    static const char *name()
+    {
+        return "manifold";
+    }
+
+    static Eigen::Quaterniond expQ(const Eigen::Vector3d &theta)
+    {
+        double angle = theta.norm();
+        if (angle < 1e-10)
+            return Eigen::Quaterniond(1, 0.5 * theta(0), 0.5 * theta(1), 0.5 * theta(2)).normalized();
+        double s = std::sin(0.5 * angle) / angle;
+        return Eigen::Quaterniond(std::cos(0.5 * angle), s * theta(0), s * theta(1), s * theta(2));
+    }
+
+    // 角速度从w0线性变化到w1，时长h内的旋转
+    static Eigen::Quaterniond magnus(const Eigen::Vector3d &w0, const Eigen::Vector3d &w1, double h)
+    {
+        return expQ(0.5 * (w0 + w1) * h + h * h / 12.0 * w0.cross(w1));
+    }
+
+    static void integrate(double _dt,
+                          const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+                          const Eigen::Vector3d &_acc_1, const Eigen::Vector3d &_gyr_1,
+                          const Eigen::Vector3d &linearized_ba, const Eigen::Vector3d &linearized_bg,
+                          const Eigen::Vector3d &delta_p, const Eigen::Quaterniond &delta_q, const Eigen::Vector3d &delta_v,
+                          Eigen::Vector3d &result_delta_p, Eigen::Quaterniond &result_delta_q, Eigen::Vector3d &result_delta_v)
+    {
+        Eigen::Vector3d a0 = _acc_0 - linearized_ba, a1 = _acc_1 - linearized_ba;
+        Eigen::Vector3d w0 = _gyr_0 - linearized_bg, w1 = _gyr_1 - linearized_bg;
+        Eigen::Vector3d wm = 0.5 * (w0 + w1);
+
+        Eigen::Quaterniond q_mid = delta_q * magnus(w0, wm, 0.5 * _dt);
+        result_delta_q = delta_q * magnus(w0, w1, _dt);
+        result_delta_q.normalize();
+
+        Eigen::Vector3d f0 = delta_q * a0;
+        Eigen::Vector3d fm = q_mid * (0.5 * (a0 + a1));
+        Eigen::Vector3d f1 = result_delta_q * a1;
+        result_delta_v = delta_v + _dt / 6.0 * (f0 + 4 * fm + f1);
+        result_delta_p = delta_p + delta_v * _dt + _dt * _dt / 6.0 * (f0 + 2 * fm);
+    }
+};
@@ -11,18 +11,6 @@
 
 void ResidualBlockInfo::Evaluate()
 {
-    residuals.resize(cost_function->num_residuals());
-
-    std::vector<int> block_sizes = cost_function->parameter_block_sizes();  //参数块数目
-    raw_jacobians = new double *[block_sizes.size()];
-    jacobians.resize(block_sizes.size());
-
-    for (int i = 0; i < static_cast<int>(block_sizes.size()); i++)
-    {
-        jacobians[i].resize(cost_function->num_residuals(), block_sizes[i]);
-        raw_jacobians[i] = jacobians[i].data();
-        //dim += block_sizes[i] == 7 ? 6 : block_sizes[i];
-    }
     cost_function->Evaluate(parameter_blocks.data(), residuals.data(), raw_jacobians);  //调用cost function计算残差与雅克比
 
     //std::vector<int> tmp_idx(block_sizes.size());
@@ -70,7 +58,11 @@ void ResidualBlockInfo::Evaluate()
 
         for (int i = 0; i < static_cast<int>(parameter_blocks.size()); i++)
         {
-            jacobians[i] = sqrt_rho1_ * (jacobians[i] - alpha_sq_norm_ * residuals * (residuals.transpose() * jacobians[i]));
+            for (int c = 0; c < jacobians[i].cols(); c++)  //逐列计算，避免residuals^T * J的临时变量
+            {
+                double r_j = residuals.dot(jacobians[i].col(c));
+                jacobians[i].col(c) = sqrt_rho1_ * (jacobians[i].col(c) - alpha_sq_norm_ * r_j * residuals);
+            }
         }
 
         residuals *= residual_scaling_;
@@ -81,60 +73,100 @@ MarginalizationInfo::~MarginalizationInfo()
 {
     //ROS_WARN("release marginlizationinfo");
     
-    for (auto it = parameter_block_data.begin(); it != parameter_block_data.end(); ++it)
-        delete it->second;
-
     for (int i = 0; i < (int)factors.size(); i++)
     {
-
-        delete[] factors[i]->raw_jacobians;
-        
         delete factors[i]->cost_function;
 
         delete factors[i];
     }
 }
 
-void MarginalizationInfo::addResidualBlockInfo(ResidualBlockInfo *residual_block_info)  //构建将边缘化变量部分的parameter_block_size和parameter_block_idx
+void MarginalizationInfo::addResidualBlockInfo(ResidualBlockInfo *residual_block_info)  //登记参数块，确定各参数块的编号、尺寸以及是否需要边缘化
 {
     factors.emplace_back(residual_block_info);
 
     std::vector<double *> &parameter_blocks = residual_block_info->parameter_blocks;  //参数块（引用）
-    std::vector<int> parameter_block_sizes = residual_block_info->cost_function->parameter_block_sizes();  //每个参数块中参数的数目localSize
+    const std::vector<int> &parameter_block_sizes = residual_block_info->cost_function->parameter_block_sizes();  //每个参数块中参数的数目globalSize
 
-    for (int i = 0; i < static_cast<int>(residual_block_info->parameter_blocks.size()); i++)
+    residual_block_info->block_ids.resize(parameter_blocks.size());
+    for (int i = 0; i < static_cast<int>(parameter_blocks.size()); i++)
     {
-        double *addr = parameter_blocks[i];
-        int size = parameter_block_sizes[i];
-        parameter_block_size[reinterpret_cast<long>(addr)] = size;
+        long addr = reinterpret_cast<long>(parameter_blocks[i]);
+        auto it = block_id.find(addr);
+        int id;
+        if (it == block_id.end())
+        {
+            id = block_addr.size();
+            block_id[addr] = id;
+            block_addr.push_back(parameter_blocks[i]);
+            block_size.push_back(parameter_block_sizes[i]);
+            block_drop.push_back(0);
+        }
+        else
+            id = it->second;
+        block_size[id] = parameter_block_sizes[i];
+        residual_block_info->block_ids[i] = id;
     }
 
     for (int i = 0; i < static_cast<int>(residual_block_info->drop_set.size()); i++)
-    {
-        double *addr = parameter_blocks[residual_block_info->drop_set[i]];
-        parameter_block_idx[reinterpret_cast<long>(addr)] = 0;
-    }
+        block_drop[residual_block_info->block_ids[residual_block_info->drop_set[i]]] = 1;
 }
 
-void MarginalizationInfo::preMarginalize()  //构建parameter_block_data <变量的内存地址， 变量数据>
+void MarginalizationInfo::preMarginalize()  //计算各残差与雅克比，并将所有参数块的数据连续保存为线性化点
 {
+    // 为所有残差块的残差与雅克比一次性分配连续存储，并建立各雅克比的视图，Evaluate中不再分配内存
+    int num_factors = factors.size();
+    int num_data = 0, num_ptrs = 0;
     for (auto it : factors)
     {
-        it->Evaluate();  //求解残差因子对应的残差与雅克比
-
-        std::vector<int> block_sizes = it->cost_function->parameter_block_sizes();  //代价函数对应的优化变量参数块的数目
-        for (int i = 0; i < static_cast<int>(block_sizes.size()); i++)
+        int rows = it->cost_function->num_residuals();
+        num_data += rows;
+        for (int size : it->cost_function->parameter_block_sizes())
+            num_data += rows * size;
+        num_ptrs += it->parameter_blocks.size();
+    }
+    jacobian_data.resize(num_data);
+    jacobian_ptrs.resize(num_ptrs);
+    jacobian_maps.clear();
+    jacobian_maps.reserve(num_ptrs);  //预留全部容量，之后的emplace_back不会使已有视图失效
+    double *data = jacobian_data.data();
+    double **ptrs = jacobian_ptrs.data();
+    for (auto it : factors)
+    {
+        int rows = it->cost_function->num_residuals();
+        new (&it->residuals) Eigen::Map<Eigen::VectorXd>(data, rows);
+        data += rows;
+        it->raw_jacobians = ptrs;
+        it->jacobians = jacobian_maps.data() + jacobian_maps.size();
+        for (int size : it->cost_function->parameter_block_sizes())
         {
-            long addr = reinterpret_cast<long>(it->parameter_blocks[i]);
-            int size = block_sizes[i];
-            if (parameter_block_data.find(addr) == parameter_block_data.end())
-            {
-                double *data = new double[size];
-                memcpy(data, it->parameter_blocks[i], sizeof(double) * size);
-                parameter_block_data[addr] = data;
-            }
+            *ptrs++ = data;
+            jacobian_maps.emplace_back(data, rows, size);
+            data += rows * size;
         }
     }
+
+    std::function<void(int, int, int)> evaluate = [&](int begin, int end, int)
+    {
+        for (int f = begin; f < end; f++)
+            factors[f]->Evaluate();  //求解残差因子对应的残差与雅克比
+    };
+    if (thread_pool)
+        thread_pool->parallelFor(num_factors, evaluate);
+    else
+        evaluate(0, num_factors, 0);
+
+    int num_blocks = block_addr.size();
+    block_data_offset.resize(num_blocks);
+    int total = 0;
+    for (int k = 0; k < num_blocks; k++)
+    {
+        block_data_offset[k] = total;
+        total += block_size[k];
+    }
+    block_data.resize(total);
+    for (int k = 0; k < num_blocks; k++)
+        memcpy(block_data.data() + block_data_offset[k], block_addr[k], sizeof(double) * block_size[k]);
 }
 
 int MarginalizationInfo::localSize(int size) const
@@ -147,61 +179,198 @@ int MarginalizationInfo::globalSize(int size) const
     return size == 6 ? 7 : size;
 }
 
-void* ThreadsConstructA(void* threadsstruct)
+/**构建A = J^T*J、b = J^T*r。参数块按索引顺序划分为若干组，每组归一个线程，组的划分使各线程的计算量大致相等；
+ * 两个参数块构成的块只累加到上三角，由索引较小的参数块所在的线程负责，因此各线程写入的行互不重叠，无需逐线程的A矩阵与归约；
+ * 上三角完成后，各线程再将自己负责的行的下三角由上三角镜像得到。
+ * ml > 0时前ml个索引为两两不共享残差的标量参数块（逆深度），其对角元、b与其余部分的耦合分别累加到Dll、bl、Alo（ml x (pos-ml)），
+ * 逆深度之间的块恒为零，不予构建；A、b仅含其余pos-ml维
+**/
+void MarginalizationInfo::constructHessian(int pos, int ml, Eigen::VectorXd &Dll, Eigen::VectorXd &bl, Eigen::MatrixXd &Alo,
+                                           Eigen::MatrixXd &A, Eigen::VectorXd &b)
 {
-    ThreadsStruct* p = ((ThreadsStruct*)threadsstruct);
-    for (auto it : p->sub_factors)  //遍历残差因子
+    // 参数块按索引排序后的序号
+    int num_blocks = block_addr.size();
+    std::vector<std::pair<int, int>> sorted_ids(num_blocks);  //<索引, 编号>
+    for (int id = 0; id < num_blocks; id++)
+        sorted_ids[id] = std::make_pair(block_idx[id], id);
+    std::sort(sorted_ids.begin(), sorted_ids.end());
+    std::vector<std::pair<int, int>> blocks(num_blocks);  //<索引, localSize>
+    std::vector<int> rank_of(num_blocks);
+    for (int k = 0; k < num_blocks; k++)
+    {
+        int id = sorted_ids[k].second;
+        blocks[k] = std::make_pair(block_idx[id], localSize(block_size[id]));
+        rank_of[id] = k;
+    }
+
+    std::vector<std::vector<int>> factor_blocks(factors.size());
+    std::vector<double> block_cost(blocks.size(), 0.0);
+    for (int f = 0; f < (int)factors.size(); f++)
+    {
+        ResidualBlockInfo *it = factors[f];
+        for (int i = 0; i < static_cast<int>(it->block_ids.size()); i++)
+            factor_blocks[f].push_back(rank_of[it->block_ids[i]]);
+        int rows = it->residuals.size();
+        for (int i = 0; i < (int)factor_blocks[f].size(); i++)
+            for (int j = i; j < (int)factor_blocks[f].size(); j++)
+            {
+                int bi = factor_blocks[f][i], bj = factor_blocks[f][j];
+                block_cost[std::min(bi, bj)] += rows * blocks[bi].second * blocks[bj].second;
+            }
+    }
+
+    int num_groups = thread_pool ? std::max(1, thread_pool->numThreads()) : 1;
+    double total_cost = 0;
+    for (double c : block_cost)
+        total_cost += c;
+    std::vector<int> block_group(blocks.size());
+    std::vector<int> group_row(num_groups + 1, pos);  //各组负责的行范围[group_row[g], group_row[g+1])
+    group_row[0] = 0;
+    double acc_cost = 0;
+    for (int k = 0, g = 0; k < (int)blocks.size(); k++)
     {
-        for (int i = 0; i < static_cast<int>(it->parameter_blocks.size()); i++)  //遍历状态向量
+        while (g < num_groups - 1 && acc_cost >= total_cost * (g + 1) / num_groups)
+            group_row[++g] = blocks[k].first;
+        block_group[k] = g;
+        acc_cost += block_cost[k];
+    }
+
+    int o = pos - ml;
+    Dll.resize(ml);
+    bl.resize(ml);
+    Alo.resize(ml, o);
+    A.resize(o, o);
+    b.resize(o);
+    std::function<void(int, int, int)> accumulate = [&](int begin, int end, int)
+    {
+        for (int g = begin; g < end; g++)
         {
-            int idx_i = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[i])];
-            int size_i = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])];
-            if (size_i == 7)
-                size_i = 6;
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
-            for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
+            int row0 = group_row[g], row1 = group_row[g + 1];
+            int l0 = std::min(row0, ml), l1 = std::min(row1, ml);
+            int o0 = std::max(row0, ml) - ml, o1 = std::max(row1, ml) - ml;
+            Dll.segment(l0, l1 - l0).setZero();
+            bl.segment(l0, l1 - l0).setZero();
+            Alo.middleRows(l0, l1 - l0).setZero();
+            A.middleRows(o0, o1 - o0).setZero();
+            b.segment(o0, o1 - o0).setZero();
+            for (int f = 0; f < (int)factors.size(); f++)
             {
-                int idx_j = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
-                int size_j = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])];
-                if (size_j == 7)
-                    size_j = 6;
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
-                if (i == j)
-                    p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                else
+                ResidualBlockInfo *it = factors[f];
+                const std::vector<int> &ids = factor_blocks[f];
+                for (int i = 0; i < (int)ids.size(); i++)
                 {
-                    p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                    p->A.block(idx_j, idx_i, size_j, size_i) = p->A.block(idx_i, idx_j, size_i, size_j).transpose();
+                    int idx_i = blocks[ids[i]].first, size_i = blocks[ids[i]].second;
+                    if (block_group[ids[i]] == g)
+                    {
+                        if (idx_i < ml)
+                            bl(idx_i) += it->jacobians[i].col(0).dot(it->residuals);
+                        else
+                            b.segment(idx_i - ml, size_i).noalias() += it->jacobians[i].leftCols(size_i).transpose() * it->residuals;
+                    }
+                    for (int j = i; j < (int)ids.size(); j++)
+                    {
+                        int a = i, c = j;  //a为索引较小的参数块
+                        if (ids[j] < ids[i])
+                            std::swap(a, c);
+                        if (block_group[ids[a]] != g)
+                            continue;
+                        int idx_a = blocks[ids[a]].first, size_a = blocks[ids[a]].second;
+                        int idx_c = blocks[ids[c]].first, size_c = blocks[ids[c]].second;
+                        if (idx_a >= ml)
+                            A.block(idx_a - ml, idx_c - ml, size_a, size_c).noalias() += it->jacobians[a].leftCols(size_a).transpose() * it->jacobians[c].leftCols(size_c);
+                        else if (a == c)
+                            Dll(idx_a) += it->jacobians[a].col(0).squaredNorm();
+                        else  //逆深度两两不共享残差，c必为其余部分的参数块
+                            Alo.block(idx_a, idx_c - ml, 1, size_c).noalias() += it->jacobians[a].col(0).transpose() * it->jacobians[c].leftCols(size_c);
+                    }
                 }
             }
-            p->b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;
         }
+    };
+    std::function<void(int, int, int)> mirror = [&](int begin, int end, int)
+    {
+        for (int g = begin; g < end; g++)
+            for (int r = std::max(group_row[g], ml) - ml; r < std::max(group_row[g + 1], ml) - ml; r++)
+                A.row(r).head(r) = A.col(r).head(r).transpose();
+    };
+    if (thread_pool && num_groups > 1)
+    {
+        thread_pool->parallelFor(num_groups, accumulate);
+        thread_pool->parallelFor(num_groups, mirror);
+    }
+    else
+    {
+        accumulate(0, num_groups, 0);
+        mirror(0, num_groups, 0);
+    }
+}
+
+// 对半正定矩阵A做对角选主元的Cholesky分解 A(perm, perm) = L*L^T，剩余对角元的最大值不大于tol时停止，返回秩
+static int pivotedCholesky(const Eigen::MatrixXd &A, double tol, Eigen::MatrixXd &L, Eigen::VectorXi &perm)
+{
+    int size = A.rows();
+    Eigen::MatrixXd W = A;
+    L = Eigen::MatrixXd::Zero(size, size);
+    perm.resize(size);
+    for (int i = 0; i < size; i++)
+        perm(i) = i;
+
+    int k = 0;
+    for (; k < size; k++)
+    {
+        int p;
+        double pivot = W.diagonal().tail(size - k).maxCoeff(&p);
+        p += k;
+        if (!(pivot > tol))
+            break;
+        if (p != k)
+        {
+            W.row(k).swap(W.row(p));
+            W.col(k).swap(W.col(p));
+            L.row(k).swap(L.row(p));
+            std::swap(perm(k), perm(p));
+        }
+        int rest = size - k - 1;
+        L(k, k) = sqrt(W(k, k));
+        L.col(k).tail(rest) = W.col(k).tail(rest) / L(k, k);
+        W.bottomRightCorner(rest, rest).noalias() -= L.col(k).tail(rest) * L.col(k).tail(rest).transpose();
     }
-    return threadsstruct;
+    return k;
 }
 
 void MarginalizationInfo::marginalize()
 {
+    int num_blocks = block_addr.size();
+    block_idx.assign(num_blocks, -1);
     int pos = 0;
-    for (auto &it : parameter_block_idx)  //构建边缘化变量部分的索引，即将需要边缘化部分的变量放置在前面
+    int ml = 0;  //尺寸为1的边缘化变量（逆深度）的数目，排在最前面
+    for (int pass = 0; pass < 2; pass++)
     {
-        it.second = pos;
-        pos += localSize(parameter_block_size[it.first]);
-    }  //此时parameter_block_idx仅有需要边缘化变量的信息
+        for (int id = 0; id < num_blocks; id++)  //构建边缘化变量部分的索引，即将需要边缘化部分的变量放置在前面
+        {
+            int size = localSize(block_size[id]);
+            if (!block_drop[id] || (size == 1) != (pass == 0))
+                continue;
+            block_idx[id] = pos;
+            pos += size;
+        }
+        if (pass == 0)
+            ml = pos;
+    }
 
     m = pos;  //边缘化变量的localSize和
 
-    for (const auto &it : parameter_block_size)  //将保留的部分添加到parameter_block_idx，即形成边缘化部分（边缘化状态量的localSize为m）在前，保留的部分（保留状态量的localsize为n）在后的情形
+    for (int id = 0; id < num_blocks; id++)  //保留的部分排在边缘化部分（边缘化状态量的localSize为m）之后（保留状态量的localsize为n）
     {
-        if (parameter_block_idx.find(it.first) == parameter_block_idx.end())  //该优化变量还未在parameter_block_idx中
+        if (!block_drop[id])
         {
-            parameter_block_idx[it.first] = pos;
-            pos += localSize(it.second);
+            block_idx[id] = pos;
+            pos += localSize(block_size[id]);
         }
     }
 
     n = pos - m;  //保留变量的localSize和
-    //ROS_INFO("marginalization, pos: %d, m: %d, n: %d, size: %d", pos, m, n, (int)parameter_block_idx.size());
+    //ROS_INFO("marginalization, pos: %d, m: %d, n: %d, size: %d", pos, m, n, num_blocks);
     if(m == 0)  //即没有需要边缘化的状态量
     {
         valid = false;
@@ -209,103 +378,79 @@ void MarginalizationInfo::marginalize()
         return;
     }
 
-    TicToc t_summing;
-    Eigen::MatrixXd A(pos, pos);
-    Eigen::VectorXd b(pos);
-    A.setZero();
-    b.setZero();
-    /*
-    for (auto it : factors)  //单线程构建A和b
+    // 任意残差至多含一个被边缘化的逆深度时，Amm左上角逆深度部分为对角阵，可逐个消去；该结构只需由残差块的参数块判断，
+    // 成立时逆深度之间的块不予构建，构建与消去的代价均与逆深度数目成线性
+    bool diagonal = ml > 0;
+    for (int i = 0; i < (int)factors.size() && diagonal; i++)
     {
-        for (int i = 0; i < static_cast<int>(it->parameter_blocks.size()); i++)
+        int cnt = 0;
+        for (int id : factors[i]->block_ids)
         {
-            int idx_i = parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[i])];
-            int size_i = localSize(parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])]);
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
-            for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
-            {
-                int idx_j = parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
-                int size_j = localSize(parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])]);
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
-                if (i == j)
-                    A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                else
-                {
-                    A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                    A.block(idx_j, idx_i, size_j, size_i) = A.block(idx_i, idx_j, size_i, size_j).transpose();
-                }
-            }
-            b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;
+            if (block_drop[id] && block_idx[id] < ml)
+                cnt++;
         }
+        diagonal = cnt <= 1;
     }
-    ROS_INFO("summing up costs %f ms", t_summing.toc());
-    */
-    //multi thread
-
-    //多线程构建A和b
-    TicToc t_thread_summing;
-    pthread_t tids[NUM_THREADS];
-    ThreadsStruct threadsstruct[NUM_THREADS];
-    int i = 0;
-    for (auto it : factors)
+    if (!diagonal)
+        ml = 0;
+
+    TicToc t_summing;
+    Eigen::VectorXd Dll, bl;
+    Eigen::MatrixXd Alo;
+    Eigen::MatrixXd A;
+    Eigen::VectorXd b;
+    constructHessian(pos, ml, Dll, bl, Alo, A, b);
+    //ROS_DEBUG("summing up costs %f ms", t_summing.toc());
+
+    if (ml > 0)
     {
-        threadsstruct[i].sub_factors.push_back(it);
-        i++;
-        i = i % NUM_THREADS;
+        // 对角元不大于eps的逆深度（几乎不含信息，与其余部分的耦合同样可忽略）按伪逆取零，与特征值分解的处理一致
+        Eigen::VectorXd Dinv = (Dll.array() > eps).select(Dll.array().inverse(), 0.0).matrix();
+        Eigen::MatrixXd DinvAlo = Dinv.asDiagonal() * Alo;
+        A.noalias() -= Alo.transpose() * DinvAlo;
+        b.noalias() -= DinvAlo.transpose() * bl;
     }
-    for (int i = 0; i < NUM_THREADS; i++)
+    int ms = m - ml;  //需要稠密分解消去的维数
+
+    if (ms > 0)
     {
-        TicToc zero_matrix;
-        threadsstruct[i].A = Eigen::MatrixXd::Zero(pos,pos);
-        threadsstruct[i].b = Eigen::VectorXd::Zero(pos);
-        threadsstruct[i].parameter_block_size = parameter_block_size;
-        threadsstruct[i].parameter_block_idx = parameter_block_idx;
-        int ret = pthread_create( &tids[i], NULL, ThreadsConstructA ,(void*)&(threadsstruct[i]));  //采用多线程构建hessian矩阵 tzhang
-        if (ret != 0)
+        //为确保数值稳定性，从数值上保证Amm对称
+        Eigen::MatrixXd Amm = 0.5 * (A.block(0, 0, ms, ms) + A.block(0, 0, ms, ms).transpose());
+        Eigen::VectorXd bmm = b.segment(0, ms);
+        Eigen::MatrixXd Amr = A.block(0, ms, ms, n);
+        Eigen::MatrixXd Arm = A.block(ms, 0, n, ms);
+        Eigen::MatrixXd Arr = A.block(ms, ms, n, n);  //保留的部分
+        Eigen::VectorXd brr = b.segment(ms, n);
+
+        // Amm正定且条件数正常时用Cholesky求解；奇异或病态时退回特征值分解的伪逆
+        Eigen::LLT<Eigen::MatrixXd> llt(Amm);
+        if (llt.info() == Eigen::Success && llt.rcond() > 1e-12)
         {
-            ROS_WARN("pthread_create error");
-            ROS_BREAK();
+            A = Arr - Arm * llt.solve(Amr);
+            b = brr - Arm * llt.solve(bmm);
+        }
+        else
+        {
+            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(Amm);
+            Eigen::MatrixXd Amm_inv = saes.eigenvectors() * Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() * saes.eigenvectors().transpose();
+            A = Arr - Arm * Amm_inv * Amr;
+            b = brr - Arm * Amm_inv * bmm;
         }
     }
-    for( int i = NUM_THREADS - 1; i >= 0; i--)  
-    {
-        pthread_join( tids[i], NULL ); 
-        A += threadsstruct[i].A;
-        b += threadsstruct[i].b;
-    }
-    //ROS_DEBUG("thread summing up costs %f ms", t_thread_summing.toc());
-    //ROS_INFO("A diff %f , b diff %f ", (A - tmp_A).sum(), (b - tmp_b).sum());
-
-
-    //为确保数值稳定性，从数值上保证Amm对称
-    Eigen::MatrixXd Amm = 0.5 * (A.block(0, 0, m, m) + A.block(0, 0, m, m).transpose());
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(Amm);
-
-    //ROS_ASSERT_MSG(saes.eigenvalues().minCoeff() >= -1e-4, "min eigenvalue %f", saes.eigenvalues().minCoeff());
 
-    Eigen::MatrixXd Amm_inv = saes.eigenvectors() * Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() * saes.eigenvectors().transpose();
-    //printf("error1: %f\n", (Amm * Amm_inv - Eigen::MatrixXd::Identity(m, m)).sum());
-
-    Eigen::VectorXd bmm = b.segment(0, m);
-    Eigen::MatrixXd Amr = A.block(0, m, m, n);
-    Eigen::MatrixXd Arm = A.block(m, 0, n, m);
-    Eigen::MatrixXd Arr = A.block(m, m, n, n);  //保留的部分
-    Eigen::VectorXd brr = b.segment(m, n);
-    A = Arr - Arm * Amm_inv * Amr;  //Arr为n x n矩阵，而A为pos x pos矩阵，二者如何能够赋值运算？？下同
-    b = brr - Arm * Amm_inv * bmm;  //Eigen的MatrixXd矩阵类型，矩阵维度会随着实际赋值，而自动改变矩阵维度，此处ok
-
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes2(A);
-    Eigen::VectorXd S = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array(), 0));
-    Eigen::VectorXd S_inv = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array().inverse(), 0));
-
-    Eigen::VectorXd S_sqrt = S.cwiseSqrt();
-    Eigen::VectorXd S_inv_sqrt = S_inv.cwiseSqrt();
-
-    linearized_jacobians = S_sqrt.asDiagonal() * saes2.eigenvectors().transpose();  //通过对Hessian矩阵分解，求解雅克比矩阵
-    linearized_residuals = S_inv_sqrt.asDiagonal() * saes2.eigenvectors().transpose() * b;  //分解Hessian矩阵，求解残差 e0 = inv(JT)*b
-    //std::cout << A << std::endl
-    //          << std::endl;
-    //std::cout << linearized_jacobians << std::endl;
+    // 选主元Cholesky分解 P*A*P^T = L*L^T，剩余对角元不大于eps时停止，得到 J = L^T*P，e0 = inv(L1)*P*b，使 J^T*J = A，J^T*e0 = b
+    Eigen::MatrixXd L;
+    Eigen::VectorXi perm;
+    int rank = pivotedCholesky(A, eps, L, perm);
+    Eigen::VectorXd Pb(n);
+    for (int i = 0; i < n; i++)
+        Pb(i) = b(perm(i));
+
+    linearized_jacobians = Eigen::MatrixXd::Zero(n, n);
+    linearized_residuals = Eigen::VectorXd::Zero(n);
+    for (int j = 0; j < n; j++)
+        linearized_jacobians.block(0, perm(j), rank, 1) = L.block(j, 0, 1, rank).transpose();
+    linearized_residuals.head(rank) = L.topLeftCorner(rank, rank).triangularView<Eigen::Lower>().solve(Pb.head(rank));
     //printf("error2: %f %f\n", (linearized_jacobians.transpose() * linearized_jacobians - A).sum(),
     //      (linearized_jacobians.transpose() * linearized_residuals - b).sum());
 }
@@ -317,14 +462,14 @@ std::vector<double *> MarginalizationInfo::getParameterBlocks(std::unordered_map
     keep_block_idx.clear();
     keep_block_data.clear();
 
-    for (const auto &it : parameter_block_idx)
+    for (int id = 0; id < static_cast<int>(block_addr.size()); id++)
     {
-        if (it.second >= m)  //排序大于m的部分为保留的部分，将该部分状态向量的localSize、index、数据、保存数据的地址进行保留
+        if (!block_drop[id])  //保留的部分，将该部分状态向量的尺寸、index、数据、保存数据的地址进行保留
         {
-            keep_block_size.push_back(parameter_block_size[it.first]);
-            keep_block_idx.push_back(parameter_block_idx[it.first]);
-            keep_block_data.push_back(parameter_block_data[it.first]);
-            keep_block_addr.push_back(addr_shift[it.first]);  //仅仅记录滑窗中保留部分的地址
+            keep_block_size.push_back(block_size[id]);
+            keep_block_idx.push_back(block_idx[id]);
+            keep_block_data.push_back(block_data.data() + block_data_offset[id]);
+            keep_block_addr.push_back(addr_shift[reinterpret_cast<long>(block_addr[id])]);  //仅仅记录滑窗中保留部分的地址
         }
     }
     sum_block_size = std::accumulate(std::begin(keep_block_size), std::end(keep_block_size), 0);
@@ -332,6 +477,29 @@ std::vector<double *> MarginalizationInfo::getParameterBlocks(std::unordered_map
     return keep_block_addr;
 }
 
+// 复制边缘化得到的先验（保留参数块的线性化点、雅克比与残差），不含残差块，供MarginalizationFactor使用；用于状态快照
+MarginalizationInfo *MarginalizationInfo::clonePrior() const
+{
+    MarginalizationInfo *prior = new MarginalizationInfo(thread_pool);
+    prior->m = m;
+    prior->n = n;
+    prior->sum_block_size = sum_block_size;
+    prior->valid = valid;
+    prior->keep_block_size = keep_block_size;
+    prior->keep_block_idx = keep_block_idx;
+    prior->block_data.resize(sum_block_size);
+    int offset = 0;
+    for (int i = 0; i < static_cast<int>(keep_block_size.size()); i++)
+    {
+        std::copy(keep_block_data[i], keep_block_data[i] + keep_block_size[i], prior->block_data.data() + offset);
+        prior->keep_block_data.push_back(prior->block_data.data() + offset);
+        offset += keep_block_size[i];
+    }
+    prior->linearized_jacobians = linearized_jacobians;
+    prior->linearized_residuals = linearized_residuals;
+    return prior;
+}
+
 MarginalizationFactor::MarginalizationFactor(MarginalizationInfo* _marginalization_info):marginalization_info(_marginalization_info)
 {  //该类模仿ceres的cost function写的
     int cnt = 0;
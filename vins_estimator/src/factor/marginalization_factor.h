@@ -12,19 +12,18 @@
 #include <ros/ros.h>
 #include <ros/console.h>
 #include <cstdlib>
-#include <pthread.h>
 #include <ceres/ceres.h>
 #include <unordered_map>
 
 #include "../utility/utility.h"
 #include "../utility/tic_toc.h"
-
-const int NUM_THREADS = 4;  //边缘化过程中构建A、b的线程数目
+#include "../utility/thread_pool.h"
 
 struct ResidualBlockInfo  //模拟ceres中的costfunction的操作，主要完成残差与雅克比计算
 {
     ResidualBlockInfo(ceres::CostFunction *_cost_function, ceres::LossFunction *_loss_function, std::vector<double *> _parameter_blocks, std::vector<int> _drop_set)
-        : cost_function(_cost_function), loss_function(_loss_function), parameter_blocks(_parameter_blocks), drop_set(_drop_set) {}
+        : cost_function(_cost_function), loss_function(_loss_function), parameter_blocks(_parameter_blocks), drop_set(_drop_set),
+          raw_jacobians(nullptr), jacobians(nullptr), residuals(nullptr, 0) {}
 
     void Evaluate();
 
@@ -32,10 +31,14 @@ struct ResidualBlockInfo  //模拟ceres中的costfunction的操作，主要完
     ceres::LossFunction *loss_function;
     std::vector<double *> parameter_blocks;  //与该残差相关的优化变量数据
     std::vector<int> drop_set;  //待边缘化的优化变量ID（PS:待边缘化的优化变量是与残差相关的优化变量数据的子集）
+    std::vector<int> block_ids;  //各参数块在MarginalizationInfo中的编号，添加时确定
+
+    typedef Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> JacobianMap;
 
+    // 以下均由MarginalizationInfo::preMarginalize在其jacobian_data、jacobian_ptrs、jacobian_maps中分配
     double **raw_jacobians;  //雅克比
-    std::vector<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobians;
-    Eigen::VectorXd residuals;  //残差向量：预积分——15x1； 视觉——2x1
+    JacobianMap *jacobians;  //各参数块雅克比的视图
+    Eigen::Map<Eigen::VectorXd> residuals;  //残差向量：预积分——15x1； 视觉——2x1
 
     int localSize(int size)
     {
@@ -43,44 +46,48 @@ struct ResidualBlockInfo  //模拟ceres中的costfunction的操作，主要完
     }
 };
 
-struct ThreadsStruct
-{
-    std::vector<ResidualBlockInfo *> sub_factors;
-    Eigen::MatrixXd A;
-    Eigen::VectorXd b;
-    std::unordered_map<long, int> parameter_block_size; //global size
-    std::unordered_map<long, int> parameter_block_idx; //local size
-};
-
 class MarginalizationInfo
 {
   public:
-    MarginalizationInfo(){valid = true;};
+    MarginalizationInfo(ThreadPool *_thread_pool = nullptr) : thread_pool(_thread_pool) {valid = true;};
     ~MarginalizationInfo();
     int localSize(int size) const;
     int globalSize(int size) const;
     void addResidualBlockInfo(ResidualBlockInfo *residual_block_info);
     void preMarginalize();
     void marginalize();
+    void constructHessian(int pos, int ml, Eigen::VectorXd &Dll, Eigen::VectorXd &bl, Eigen::MatrixXd &Alo, Eigen::MatrixXd &A, Eigen::VectorXd &b);
     std::vector<double *> getParameterBlocks(std::unordered_map<long, double *> &addr_shift);
+    MarginalizationInfo *clonePrior() const;
 
     std::vector<ResidualBlockInfo *> factors;  //所有观测量
     int m, n;  //m表征需要边缘化的变量的localSize和，n表征保留的变量的localSize和， 二者均以localSize计算表示 tzhang
-    //下述unordered_map关键字long使用的是状态向量的内存地址
-    std::unordered_map<long, int> parameter_block_size; //global size  存储每个状态向量的尺寸 <变量的内存地址，变量的localSize>
     int sum_block_size;
-    std::unordered_map<long, int> parameter_block_idx; //local size  存储每个状态向量的索引。<变量的内存地址， 构建矩阵的索引（结果是前m为边缘化部分，后n为保留部分）>
-    std::unordered_map<long, double *> parameter_block_data;  //存储状态向量的数据 <变量的内存地址， 变量数据>
+
+    // 参数块登记表：参数块按首次添加的顺序编号，之后均按编号访问；仅在添加时按内存地址查找一次
+    std::unordered_map<long, int> block_id;  //<变量的内存地址，编号>
+    std::vector<double *> block_addr;  //变量的内存地址
+    std::vector<int> block_size;  //global size
+    std::vector<int> block_idx;  //local size  构建矩阵的索引（结果是前m为边缘化部分，后n为保留部分）
+    std::vector<char> block_drop;  //是否需要边缘化
+    std::vector<int> block_data_offset;  //线性化点数据在block_data中的位置
+    std::vector<double> block_data;  //所有参数块线性化点数据的连续存储
+
+    // 所有残差块的残差与雅克比的存储，preMarginalize中一次性分配，随MarginalizationInfo整体释放
+    std::vector<double> jacobian_data;
+    std::vector<double *> jacobian_ptrs;
+    std::vector<ResidualBlockInfo::JacobianMap> jacobian_maps;
 
     // 存储边缘化后最终保留的量 tzhang
     std::vector<int> keep_block_size; //global size
     std::vector<int> keep_block_idx;  //local size
-    std::vector<double *> keep_block_data;
+    std::vector<double *> keep_block_data;  //指向block_data
 
     Eigen::MatrixXd linearized_jacobians;  //边缘化得到的雅克比  tzhang  该雅克比和残差用于后续先验因子MarginalizationFactor的Evaluate中计算雅克比与残差
     Eigen::VectorXd linearized_residuals;  //边缘化得到的残差  tzhang
     const double eps = 1e-8;
     bool valid;
+    ThreadPool *thread_pool;  //计算雅克比、构建A、b所用的线程池，为空时单线程执行
 };
 
 class MarginalizationFactor : public ceres::CostFunction
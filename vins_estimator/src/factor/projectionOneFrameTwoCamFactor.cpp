@@ -11,10 +11,13 @@
 
 #include "projectionOneFrameTwoCamFactor.h"
 
-Eigen::Matrix2d ProjectionOneFrameTwoCamFactor::sqrt_info;
-double ProjectionOneFrameTwoCamFactor::sum_t;
+template <typename Scalar>
+Eigen::Matrix2d ProjectionOneFrameTwoCamFactorT<Scalar>::sqrt_info;
+template <typename Scalar>
+thread_local double ProjectionOneFrameTwoCamFactorT<Scalar>::sum_t;
 
-ProjectionOneFrameTwoCamFactor::ProjectionOneFrameTwoCamFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
+template <typename Scalar>
+ProjectionOneFrameTwoCamFactorT<Scalar>::ProjectionOneFrameTwoCamFactorT(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
                                                                const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
                                                                const double _td_i, const double _td_j) : 
                                                                pts_i(_pts_i), pts_j(_pts_j), 
@@ -39,84 +42,90 @@ ProjectionOneFrameTwoCamFactor::ProjectionOneFrameTwoCamFactor(const Eigen::Vect
 #endif
 };
 
-bool ProjectionOneFrameTwoCamFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+template <typename Scalar>
+bool ProjectionOneFrameTwoCamFactorT<Scalar>::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
 {
+    typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+    typedef Eigen::Matrix<Scalar, 3, 3> Matrix3;
+    typedef Eigen::Quaternion<Scalar> Quaternion;
+
     TicToc tic_toc;
 
-    Eigen::Vector3d tic(parameters[0][0], parameters[0][1], parameters[0][2]);
-    Eigen::Quaterniond qic(parameters[0][6], parameters[0][3], parameters[0][4], parameters[0][5]);
+    Vector3 tic = Eigen::Vector3d(parameters[0][0], parameters[0][1], parameters[0][2]).template cast<Scalar>();
+    Quaternion qic = Eigen::Quaterniond(parameters[0][6], parameters[0][3], parameters[0][4], parameters[0][5]).template cast<Scalar>();
 
-    Eigen::Vector3d tic2(parameters[1][0], parameters[1][1], parameters[1][2]);
-    Eigen::Quaterniond qic2(parameters[1][6], parameters[1][3], parameters[1][4], parameters[1][5]);
+    Vector3 tic2 = Eigen::Vector3d(parameters[1][0], parameters[1][1], parameters[1][2]).template cast<Scalar>();
+    Quaternion qic2 = Eigen::Quaterniond(parameters[1][6], parameters[1][3], parameters[1][4], parameters[1][5]).template cast<Scalar>();
 
-    double inv_dep_i = parameters[2][0];
+    Scalar inv_dep_i = parameters[2][0];
 
     double td = parameters[3][0];
 
-    Eigen::Vector3d pts_i_td, pts_j_td;
-    pts_i_td = pts_i - (td - td_i) * velocity_i;
-    pts_j_td = pts_j - (td - td_j) * velocity_j;
+    Vector3 pts_i_td, pts_j_td;
+    pts_i_td = (pts_i - (td - td_i) * velocity_i).template cast<Scalar>();
+    pts_j_td = (pts_j - (td - td_j) * velocity_j).template cast<Scalar>();
 
-    Eigen::Vector3d pts_camera_i = pts_i_td / inv_dep_i;
-    Eigen::Vector3d pts_imu_i = qic * pts_camera_i + tic;
-    Eigen::Vector3d pts_imu_j = pts_imu_i;
-    Eigen::Vector3d pts_camera_j = qic2.inverse() * (pts_imu_j - tic2);
+    Vector3 pts_camera_i = pts_i_td / inv_dep_i;
+    Vector3 pts_imu_i = qic * pts_camera_i + tic;
+    Vector3 pts_imu_j = pts_imu_i;
+    Vector3 pts_camera_j = qic2.inverse() * (pts_imu_j - tic2);
     Eigen::Map<Eigen::Vector2d> residual(residuals);
+    Eigen::Matrix<Scalar, 2, 1> res;
 
 #ifdef UNIT_SPHERE_ERROR 
-    residual =  tangent_base * (pts_camera_j.normalized() - pts_j_td.normalized());
+    res =  tangent_base.template cast<Scalar>() * (pts_camera_j.normalized() - pts_j_td.normalized());
 #else
-    double dep_j = pts_camera_j.z();
-    residual = (pts_camera_j / dep_j).head<2>() - pts_j_td.head<2>();
+    Scalar dep_j = pts_camera_j.z();
+    res = (pts_camera_j / dep_j).template head<2>() - pts_j_td.template head<2>();
 #endif
 
-    residual = sqrt_info * residual;
+    residual = sqrt_info * res.template cast<double>();
 
     if (jacobians)
     {
-        Eigen::Matrix3d ric = qic.toRotationMatrix();
-        Eigen::Matrix3d ric2 = qic2.toRotationMatrix();
-        Eigen::Matrix<double, 2, 3> reduce(2, 3);
+        Matrix3 ric = qic.toRotationMatrix();
+        Matrix3 ric2 = qic2.toRotationMatrix();
+        Eigen::Matrix<Scalar, 2, 3> reduce(2, 3);
 #ifdef UNIT_SPHERE_ERROR
-        double norm = pts_camera_j.norm();
-        Eigen::Matrix3d norm_jaco;
-        double x1, x2, x3;
+        Scalar norm = pts_camera_j.norm();
+        Matrix3 norm_jaco;
+        Scalar x1, x2, x3;
         x1 = pts_camera_j(0);
         x2 = pts_camera_j(1);
         x3 = pts_camera_j(2);
         norm_jaco << 1.0 / norm - x1 * x1 / pow(norm, 3), - x1 * x2 / pow(norm, 3),            - x1 * x3 / pow(norm, 3),
                      - x1 * x2 / pow(norm, 3),            1.0 / norm - x2 * x2 / pow(norm, 3), - x2 * x3 / pow(norm, 3),
                      - x1 * x3 / pow(norm, 3),            - x2 * x3 / pow(norm, 3),            1.0 / norm - x3 * x3 / pow(norm, 3);
-        reduce = tangent_base * norm_jaco;
+        reduce = tangent_base.template cast<Scalar>() * norm_jaco;
 #else
         reduce << 1. / dep_j, 0, -pts_camera_j(0) / (dep_j * dep_j),
             0, 1. / dep_j, -pts_camera_j(1) / (dep_j * dep_j);
 #endif
-        reduce = sqrt_info * reduce;
+        reduce = sqrt_info.template cast<Scalar>() * reduce;
 
         if (jacobians[0])
         {
             Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> jacobian_ex_pose(jacobians[0]);
-            Eigen::Matrix<double, 3, 6> jaco_ex;
-            jaco_ex.leftCols<3>() = ric2.transpose(); 
-            jaco_ex.rightCols<3>() = ric2.transpose() * ric * -Utility::skewSymmetric(pts_camera_i);
-            jacobian_ex_pose.leftCols<6>() = reduce * jaco_ex;
+            Eigen::Matrix<Scalar, 3, 6> jaco_ex;
+            jaco_ex.template leftCols<3>() = ric2.transpose(); 
+            jaco_ex.template rightCols<3>() = ric2.transpose() * ric * -Utility::skewSymmetric(pts_camera_i);
+            jacobian_ex_pose.leftCols<6>() = (reduce * jaco_ex).template cast<double>();
             jacobian_ex_pose.rightCols<1>().setZero();
         }
         if (jacobians[1])
         {
             Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> jacobian_ex_pose1(jacobians[1]);
-            Eigen::Matrix<double, 3, 6> jaco_ex;
-            jaco_ex.leftCols<3>() = - ric2.transpose();
-            jaco_ex.rightCols<3>() = Utility::skewSymmetric(pts_camera_j);
-            jacobian_ex_pose1.leftCols<6>() = reduce * jaco_ex;
+            Eigen::Matrix<Scalar, 3, 6> jaco_ex;
+            jaco_ex.template leftCols<3>() = - ric2.transpose();
+            jaco_ex.template rightCols<3>() = Utility::skewSymmetric(pts_camera_j);
+            jacobian_ex_pose1.leftCols<6>() = (reduce * jaco_ex).template cast<double>();
             jacobian_ex_pose1.rightCols<1>().setZero();
         }
         if (jacobians[2])
         {
             Eigen::Map<Eigen::Vector2d> jacobian_feature(jacobians[2]);
 #if 1
-            jacobian_feature = reduce * ric2.transpose() * ric * pts_i * -1.0 / (inv_dep_i * inv_dep_i);
+            jacobian_feature = (reduce * ric2.transpose() * ric * pts_i.template cast<Scalar>() * Scalar(-1.0) / (inv_dep_i * inv_dep_i)).template cast<double>();
 #else
             jacobian_feature = reduce * ric.transpose() * Rj.transpose() * Ri * ric * pts_i;
 #endif
@@ -124,7 +133,7 @@ bool ProjectionOneFrameTwoCamFactor::Evaluate(double const *const *parameters, d
         if (jacobians[3])
         {
             Eigen::Map<Eigen::Vector2d> jacobian_td(jacobians[3]);
-            jacobian_td = reduce * ric2.transpose() * ric * velocity_i / inv_dep_i * -1.0  +
+            jacobian_td = (reduce * ric2.transpose() * ric * velocity_i.template cast<Scalar>() / inv_dep_i * Scalar(-1.0)).template cast<double>() +
                           sqrt_info * velocity_j.head(2);
         }
     }
@@ -133,7 +142,8 @@ bool ProjectionOneFrameTwoCamFactor::Evaluate(double const *const *parameters, d
     return true;
 }
 
-void ProjectionOneFrameTwoCamFactor::check(double **parameters)
+template <typename Scalar>
+void ProjectionOneFrameTwoCamFactorT<Scalar>::check(double **parameters)
 {
     double *res = new double[15];
     double **jaco = new double *[4];
@@ -246,3 +256,6 @@ void ProjectionOneFrameTwoCamFactor::check(double **parameters)
     std::cout << num_jacobian.block<2, 1>(0, 12) << std::endl;
     std::cout << num_jacobian.block<2, 1>(0, 13) << std::endl;
 }
+
+template class ProjectionOneFrameTwoCamFactorT<double>;
+template class ProjectionOneFrameTwoCamFactorT<float>;
@@ -18,11 +18,13 @@
 #include "../utility/tic_toc.h"
 #include "../estimator/parameters.h"
 
-class ProjectionTwoFrameTwoCamFactor : public ceres::SizedCostFunction<2, 7, 7, 7, 7, 1, 1>//残差维度2； 参数维度：Xi 7维；Xj 7维；
+// Scalar为残差与雅克比的内部计算精度，参数块及输出仍为double
+template <typename Scalar>
+class ProjectionTwoFrameTwoCamFactorT : public ceres::SizedCostFunction<2, 7, 7, 7, 7, 1, 1>//残差维度2； 参数维度：Xi 7维；Xj 7维；
                                                                                       // Xbc 7维；Xbc2 7维；逆深度 1维； td 1维
 {
   public:
-    ProjectionTwoFrameTwoCamFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
+    ProjectionTwoFrameTwoCamFactorT(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
     							   const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
     				   			   const double _td_i, const double _td_j);
     virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
@@ -33,5 +35,7 @@ class ProjectionTwoFrameTwoCamFactor : public ceres::SizedCostFunction<2, 7, 7,
     double td_i, td_j;
     Eigen::Matrix<double, 2, 3> tangent_base;
     static Eigen::Matrix2d sqrt_info;
-    static double sum_t;
+    static thread_local double sum_t;  //各线程分别累计求值耗时
 };
+
+typedef ProjectionTwoFrameTwoCamFactorT<VisualScalar> ProjectionTwoFrameTwoCamFactor;
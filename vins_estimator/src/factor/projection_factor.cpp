@@ -10,7 +10,7 @@
 #include "projection_factor.h"
 
 Eigen::Matrix2d ProjectionFactor::sqrt_info;
-double ProjectionFactor::sum_t;
+thread_local double ProjectionFactor::sum_t;
 
 ProjectionFactor::ProjectionFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j) : pts_i(_pts_i), pts_j(_pts_j)
 {
@@ -0,0 +1,132 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <eigen3/Eigen/Dense>
+
+/**视觉惯性对准的正规方程求解。状态为N帧的速度（每帧3维）与K维全局量（重力、尺度）：
+ * 相邻两帧的约束只涉及v_i、v_{i+1}与全局量，正规方程的速度部分是3x3块的三对角矩阵，与全局量的耦合构成箭头形的边。
+ * 先对速度部分做块三对角分解，用Schur补消去速度求解全局量，再回代速度，耗时与帧数成线性。
+ * 各缓存保留容量，对象复用时不再分配内存
+**/
+template <int K>
+class AlignmentSolver
+{
+  public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef Eigen::Matrix<double, 6, 6 + K> PairJacobian;  //[v_i, v_{i+1}, 全局量]
+    typedef Eigen::Matrix<double, 6, 1> PairResidual;
+
+    AlignmentSolver() : num_frames(0)
+    {
+    }
+
+    // 清零正规方程，状态为n帧速度与全局量
+    void reset(int n)
+    {
+        num_frames = n;
+        if (D.cols() < 3 * n)
+        {
+            D.resize(3, 3 * n);
+            U.resize(3, 3 * n);
+            S_inv.resize(3, 3 * n);
+            C.resize(3 * n, K);
+            Y.resize(3 * n, K + 1);
+            bv.resize(3 * n);
+        }
+        D.leftCols(3 * n).setZero();
+        U.leftCols(3 * n).setZero();
+        C.topRows(3 * n).setZero();
+        bv.head(3 * n).setZero();
+        A_gg.setZero();
+        b_g.setZero();
+    }
+
+    // 累加第i、i+1帧之间的约束H * [v_i; v_{i+1}; 全局量] = z
+    void addPair(int i, const PairJacobian &H, const PairResidual &z)
+    {
+        Eigen::Matrix<double, 6 + K, 6 + K> r_A = H.transpose() * H;
+        Eigen::Matrix<double, 6 + K, 1> r_b = H.transpose() * z;
+
+        D.block<3, 3>(0, 3 * i) += r_A.template block<3, 3>(0, 0);
+        U.block<3, 3>(0, 3 * i) += r_A.template block<3, 3>(0, 3);  //A(v_i, v_{i+1})
+        D.block<3, 3>(0, 3 * i + 3) += r_A.template block<3, 3>(3, 3);
+        C.template block<6, K>(3 * i, 0) += r_A.template topRightCorner<6, K>();
+        A_gg += r_A.template bottomRightCorner<K, K>();
+
+        bv.segment<6>(3 * i) += r_b.template head<6>();
+        b_g += r_b.template tail<K>();
+    }
+
+    // 全局量的先验，以正规方程形式累加：A_gg += A，b_g += b
+    void addPrior(const Eigen::Matrix<double, K, K> &A, const Eigen::Matrix<double, K, 1> &b)
+    {
+        A_gg += A;
+        b_g += b;
+    }
+
+    // 正规方程整体乘以系数s
+    void scale(double s)
+    {
+        int n = num_frames;
+        D.leftCols(3 * n) *= s;
+        U.leftCols(3 * n) *= s;
+        C.topRows(3 * n) *= s;
+        bv.head(3 * n) *= s;
+        A_gg *= s;
+        b_g *= s;
+    }
+
+    // 求解x = [v_0, ..., v_{N-1}, 全局量]，排列与稠密正规方程一致；正规方程本身不被修改，可继续累加后再次求解
+    void solve(Eigen::VectorXd &x)
+    {
+        int n = num_frames;
+        Y.topRows(3 * n).leftCols(K) = C.topRows(3 * n);
+        Y.col(K).head(3 * n) = bv.head(3 * n);
+
+        // 前向消元：S_0 = D_0，S_i = D_i - U_{i-1}^T * S_{i-1}^{-1} * U_{i-1}，同时对右侧[C, bv]消元
+        Eigen::Matrix3d S = D.block<3, 3>(0, 0);
+        for (int i = 0; ; i++)
+        {
+            S_inv.block<3, 3>(0, 3 * i) = S.llt().solve(Eigen::Matrix3d::Identity());
+            if (i + 1 == n)
+                break;
+            Eigen::Matrix3d L = U.block<3, 3>(0, 3 * i).transpose() * S_inv.block<3, 3>(0, 3 * i);
+            Y.middleRows<3>(3 * i + 3) -= L * Y.middleRows<3>(3 * i);
+            S = D.block<3, 3>(0, 3 * i + 3) - L * U.block<3, 3>(0, 3 * i);
+        }
+
+        // 回代得到Y = A_vv^{-1} * [C, bv]
+        Y.middleRows<3>(3 * (n - 1)) = S_inv.block<3, 3>(0, 3 * (n - 1)) * Y.middleRows<3>(3 * (n - 1));
+        for (int i = n - 2; i >= 0; i--)
+            Y.middleRows<3>(3 * i) = S_inv.block<3, 3>(0, 3 * i) * (Y.middleRows<3>(3 * i) - U.block<3, 3>(0, 3 * i) * Y.middleRows<3>(3 * i + 3));
+
+        // Schur补求全局量，再回代速度
+        Eigen::Matrix<double, K, K> S_g = A_gg - C.topRows(3 * n).transpose() * Y.topRows(3 * n).leftCols(K);
+        Eigen::Matrix<double, K, 1> r_g = b_g - C.topRows(3 * n).transpose() * Y.col(K).head(3 * n);
+        Eigen::Matrix<double, K, 1> g = S_g.ldlt().solve(r_g);
+
+        x.resize(3 * n + K);
+        x.head(3 * n) = Y.col(K).head(3 * n) - Y.topRows(3 * n).leftCols(K) * g;
+        x.template tail<K>() = g;
+    }
+
+  private:
+    int num_frames;
+    Eigen::MatrixXd D;  //速度部分的对角块，3 x 3N
+    Eigen::MatrixXd U;  //速度部分的上对角块A(v_i, v_{i+1})，3 x 3N
+    Eigen::Matrix<double, Eigen::Dynamic, K> C;  //速度与全局量的耦合块
+    Eigen::VectorXd bv;
+    Eigen::Matrix<double, K, K> A_gg;
+    Eigen::Matrix<double, K, 1> b_g;
+    Eigen::MatrixXd S_inv;  //消元后各对角块的逆
+    Eigen::MatrixXd Y;  //A_vv^{-1} * [C, bv]
+};
@@ -71,10 +71,8 @@ void RefineGravity(map<double, ImageFrame> &all_image_frame, Vector3d &g, Vector
     int all_frame_count = all_image_frame.size();
     int n_state = all_frame_count * 3 + 2 + 1;  //此时限定重力模值，仅优化重力方向，因此重力相关的自由度为2
 
-    MatrixXd A{n_state, n_state};
-    A.setZero();
-    VectorXd b{n_state};
-    b.setZero();
+    static thread_local AlignmentSolver<3> solver;  //全局量为重力方向（2维）与尺度因子
+    solver.reset(all_frame_count);  //正规方程在4次迭代中持续累加
 
     map<double, ImageFrame>::iterator frame_i;
     map<double, ImageFrame>::iterator frame_j;
@@ -87,9 +85,9 @@ void RefineGravity(map<double, ImageFrame> &all_image_frame, Vector3d &g, Vector
         {
             frame_j = next(frame_i);
 
-            MatrixXd tmp_A(6, 9);  //公式（19）H（重力相关自由度变为2）
+            AlignmentSolver<3>::PairJacobian tmp_A;  //公式（19）H（重力相关自由度变为2）
             tmp_A.setZero();
-            VectorXd tmp_b(6);  //公式（18）Z（重力相关自由度变为2）
+            AlignmentSolver<3>::PairResidual tmp_b;  //公式（18）Z（重力相关自由度变为2）
             tmp_b.setZero();
 
             double dt = frame_j->second.pre_integration->sum_dt;
@@ -105,27 +103,10 @@ void RefineGravity(map<double, ImageFrame> &all_image_frame, Vector3d &g, Vector
             tmp_A.block<3, 2>(3, 6) = frame_i->second.R.transpose() * dt * Matrix3d::Identity() * lxly;  //重力相关的雅克比发生变化
             tmp_b.block<3, 1>(3, 0) = frame_j->second.pre_integration->delta_v - frame_i->second.R.transpose() * dt * Matrix3d::Identity() * g0;
 
-
-            Matrix<double, 6, 6> cov_inv = Matrix<double, 6, 6>::Zero();
-            //cov.block<6, 6>(0, 0) = IMU_cov[i + 1];
-            //MatrixXd cov_inv = cov.inverse();
-            cov_inv.setIdentity();
-
-            MatrixXd r_A = tmp_A.transpose() * cov_inv * tmp_A;
-            VectorXd r_b = tmp_A.transpose() * cov_inv * tmp_b;
-
-            A.block<6, 6>(i * 3, i * 3) += r_A.topLeftCorner<6, 6>();
-            b.segment<6>(i * 3) += r_b.head<6>();
-
-            A.bottomRightCorner<3, 3>() += r_A.bottomRightCorner<3, 3>();
-            b.tail<3>() += r_b.tail<3>();
-
-            A.block<6, 3>(i * 3, n_state - 3) += r_A.topRightCorner<6, 3>();
-            A.block<3, 6>(n_state - 3, i * 3) += r_A.bottomLeftCorner<3, 6>();
+            solver.addPair(i, tmp_A, tmp_b);  //协方差取单位阵
         }
-            A = A * 1000.0;
-            b = b * 1000.0;
-            x = A.ldlt().solve(b);
+            solver.scale(1000.0);  //与原先一致：累加的正规方程每次迭代整体乘以1000，先前迭代的约束权重更大
+            solver.solve(x);
             VectorXd dg = x.segment<2>(n_state - 3);
             g0 = (g0 + lxly * dg).normalized() * G.norm();  //更新重力向量
             //double s = x(n_state - 1);
@@ -138,10 +119,8 @@ bool LinearAlignment(map<double, ImageFrame> &all_image_frame, Vector3d &g, Vect
     int all_frame_count = all_image_frame.size();
     int n_state = all_frame_count * 3 + 3 + 1;  //该优化过程中状态向量维度，对应公式（16），速度（3*图像帧数目）、重力（3）、尺度因子（1）
 
-    MatrixXd A{n_state, n_state};  // Hessian矩阵
-    A.setZero();
-    VectorXd b{n_state};  //normal-equation方程右侧向量
-    b.setZero();
+    static thread_local AlignmentSolver<4> solver;  //块三对角+箭头形的正规方程，见alignment_solver.h
+    solver.reset(all_frame_count);
 
     map<double, ImageFrame>::iterator frame_i;
     map<double, ImageFrame>::iterator frame_j;
@@ -150,9 +129,9 @@ bool LinearAlignment(map<double, ImageFrame> &all_image_frame, Vector3d &g, Vect
     {
         frame_j = next(frame_i);
 
-        MatrixXd tmp_A(6, 10);  //公式（19）H
+        AlignmentSolver<4>::PairJacobian tmp_A;  //公式（19）H
         tmp_A.setZero();
-        VectorXd tmp_b(6);  //公式（18）Z
+        AlignmentSolver<4>::PairResidual tmp_b;  //公式（18）Z
         tmp_b.setZero();
 
         double dt = frame_j->second.pre_integration->sum_dt;
@@ -168,26 +147,9 @@ bool LinearAlignment(map<double, ImageFrame> &all_image_frame, Vector3d &g, Vect
         tmp_b.block<3, 1>(3, 0) = frame_j->second.pre_integration->delta_v;
         //cout << "delta_v   " << frame_j->second.pre_integration->delta_v.transpose() << endl;
 
-        Matrix<double, 6, 6> cov_inv = Matrix<double, 6, 6>::Zero();
-        //cov.block<6, 6>(0, 0) = IMU_cov[i + 1];
-        //MatrixXd cov_inv = cov.inverse();
-        cov_inv.setIdentity();
-
-        MatrixXd r_A = tmp_A.transpose() * cov_inv * tmp_A;  // 10x10
-        VectorXd r_b = tmp_A.transpose() * cov_inv * tmp_b;  //10x1
-
-        A.block<6, 6>(i * 3, i * 3) += r_A.topLeftCorner<6, 6>();  //速度相关部分，k、k+1时刻速度，共6维
-        b.segment<6>(i * 3) += r_b.head<6>();
-
-        A.bottomRightCorner<4, 4>() += r_A.bottomRightCorner<4, 4>();  //重力向量与尺度因子相关部分，共4维
-        b.tail<4>() += r_b.tail<4>();
-
-        A.block<6, 4>(i * 3, n_state - 4) += r_A.topRightCorner<6, 4>();
-        A.block<4, 6>(n_state - 4, i * 3) += r_A.bottomLeftCorner<4, 6>();
+        solver.addPair(i, tmp_A, tmp_b);  //协方差取单位阵；速度相关部分（k、k+1时刻速度，共6维）构成块三对角，重力向量与尺度因子为全局量
     }
-    A = A * 1000.0;  //同时乘以1000，提高数值稳定性
-    b = b * 1000.0;
-    x = A.ldlt().solve(b);  //求解normal-equation
+    solver.solve(x);  //求解normal-equation
     double s = x(n_state - 1) / 100.0;  //尺度因子s
     ROS_DEBUG("estimated scale: %f", s);
     g = x.segment<3>(n_state - 4);  //重力向量
@@ -216,3 +178,102 @@ bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs,
     else 
         return false;
 }
+
+// 双目+IMU对准中第i、i+1帧之间的约束：全局量为重力的KG维参数化（g = g0 + lxly * dg），KB = 3时另含加速度计零偏，
+// 零偏以预积分对零偏的雅克比线性修正（预积分的线性化点为0）
+template <int KG, int KB>
+static void stereoPair(const ImageFrame &frame_i, const ImageFrame &frame_j, const Matrix<double, 3, KG> &lxly, const Vector3d &g0,
+                       typename AlignmentSolver<KG + KB>::PairJacobian &tmp_A, typename AlignmentSolver<KG + KB>::PairResidual &tmp_b)
+{
+    tmp_A.setZero();
+    tmp_b.setZero();
+
+    const IntegrationBase *pre_integration = frame_j.pre_integration;
+    double dt = pre_integration->sum_dt;
+    Matrix3d R_i_inv = frame_i.R.transpose();
+
+    tmp_A.template block<3, 3>(0, 0) = -dt * Matrix3d::Identity();
+    tmp_A.template block<3, KG>(0, 6) = R_i_inv * dt * dt / 2 * lxly;
+    tmp_A.template block<3, KB>(0, 6 + KG) = -pre_integration->jacobian.template block<3, KB>(O_P, O_BA);
+    tmp_b.template block<3, 1>(0, 0) = pre_integration->delta_p - R_i_inv * (frame_j.T - frame_i.T) - R_i_inv * dt * dt / 2 * g0;
+
+    tmp_A.template block<3, 3>(3, 0) = -Matrix3d::Identity();
+    tmp_A.template block<3, 3>(3, 3) = R_i_inv * frame_j.R;
+    tmp_A.template block<3, KG>(3, 6) = R_i_inv * dt * lxly;
+    tmp_A.template block<3, KB>(3, 6 + KG) = -pre_integration->jacobian.template block<3, KB>(O_V, O_BA);
+    tmp_b.template block<3, 1>(3, 0) = pre_integration->delta_v - R_i_inv * dt * g0;
+}
+
+/**双目+IMU的对准：all_image_frame中的R、T为双目PnP得到的IMU位姿（R_w_b、t_w_b），尺度已知，
+ * 因此只需求解各帧在自身IMU坐标系下的速度、重力向量与零偏，x为各帧速度。
+ * 方程与LinearAlignment相同（去掉尺度一项，IMU位姿无需外参平移）；先求陀螺零偏，再不限制重力模值、不考虑加速度计零偏求解重力，
+ * 最后在切平面上迭代细化重力方向并同时估计加速度计零偏。帧数少、激励不足时加速度计零偏与重力方向难以区分，
+ * 因此对其加零均值的先验，权重按方程噪声的方差与先验标准差之比确定
+**/
+bool StereoInertialAlignment(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs, Vector3d* Bas, Vector3d &g, VectorXd &x)
+{
+    solveGyroscopeBias(all_image_frame, Bgs);
+
+    int all_frame_count = all_image_frame.size();
+    map<double, ImageFrame>::iterator frame_i;
+    static thread_local AlignmentSolver<3> solver_g;  //完整的重力向量
+    static thread_local AlignmentSolver<5> solver_refine;  //限定模值的重力方向与加速度计零偏
+
+    AlignmentSolver<3>::PairJacobian A_g;
+    AlignmentSolver<3>::PairResidual b_g;
+    solver_g.reset(all_frame_count);
+    int i = 0;
+    for (frame_i = all_image_frame.begin(); next(frame_i) != all_image_frame.end(); frame_i++, i++)
+    {
+        stereoPair<3, 0>(frame_i->second, next(frame_i)->second, Matrix3d::Identity(), Vector3d::Zero(), A_g, b_g);
+        solver_g.addPair(i, A_g, b_g);
+    }
+    solver_g.solve(x);
+    Vector3d g0 = x.tail<3>();
+    ROS_DEBUG_STREAM(" stereo result g     " << g0.norm() << " " << g0.transpose());
+    if (fabs(g0.norm() - G.norm()) > 0.5)  //重力向量与设定的G模值相差较大，认为失败
+        return false;
+
+    // 方程噪声的方差：取预积分速度项的平均方差与上一步残差的样本方差中较大者，后者包含了双目位姿的误差
+    double var_v = 0, res = 0;
+    i = 0;
+    for (frame_i = all_image_frame.begin(); next(frame_i) != all_image_frame.end(); frame_i++, i++)
+    {
+        var_v += next(frame_i)->second.pre_integration->covariance.block<3, 3>(O_V, O_V).trace() / 3;
+        stereoPair<3, 0>(frame_i->second, next(frame_i)->second, Matrix3d::Identity(), Vector3d::Zero(), A_g, b_g);
+        Matrix<double, 9, 1> x_i;
+        x_i << x.segment<6>(3 * i), g0;
+        res += (A_g * x_i - b_g).squaredNorm();
+    }
+    var_v /= all_frame_count - 1;
+    int dof = 6 * (all_frame_count - 1) - (3 * all_frame_count + 3);
+    if (dof > 0)
+        var_v = max(var_v, res / dof);
+    const double acc_bias_std = 0.2;  //加速度计零偏的先验标准差（m/s^2）
+    Matrix<double, 5, 5> prior_A = Matrix<double, 5, 5>::Zero();
+    prior_A.bottomRightCorner<3, 3>() = var_v / (acc_bias_std * acc_bias_std) * Matrix3d::Identity();
+
+    AlignmentSolver<5>::PairJacobian A_refine;
+    AlignmentSolver<5>::PairResidual b_refine;
+    g0 = g0.normalized() * G.norm();
+    for(int k = 0; k < 4; k++)
+    {
+        Matrix<double, 3, 2> lxly = TangentBasis(g0);
+        solver_refine.reset(all_frame_count);
+        i = 0;
+        for (frame_i = all_image_frame.begin(); next(frame_i) != all_image_frame.end(); frame_i++, i++)
+        {
+            stereoPair<2, 3>(frame_i->second, next(frame_i)->second, lxly, g0, A_refine, b_refine);
+            solver_refine.addPair(i, A_refine, b_refine);
+        }
+        solver_refine.addPrior(prior_A, Matrix<double, 5, 1>::Zero());
+        solver_refine.solve(x);
+        g0 = (g0 + lxly * x.segment<2>(3 * all_frame_count)).normalized() * G.norm();
+    }
+    g = g0;
+    Vector3d ba = x.tail<3>();
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+        Bas[i] = ba;
+    ROS_DEBUG_STREAM(" stereo refine     " << g.norm() << " " << g.transpose() << " acc bias " << ba.transpose());
+    return true;
+}
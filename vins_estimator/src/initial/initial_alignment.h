@@ -17,6 +17,7 @@
 #include <ros/ros.h>
 #include <map>
 #include "../estimator/feature_manager.h"
+#include "alignment_solver.h"
 
 using namespace Eigen;
 using namespace std;
@@ -38,4 +39,5 @@ class ImageFrame
         bool is_key_frame;
 };
 void solveGyroscopeBias(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs);
-bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs, Vector3d &g, VectorXd &x);
\ No newline at end of file
+bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs, Vector3d &g, VectorXd &x);
+bool StereoInertialAlignment(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs, Vector3d* Bas, Vector3d &g, VectorXd &x);
\ No newline at end of file
@@ -11,7 +11,21 @@
 
 #include "initial_sfm.h"
 
-GlobalSFM::GlobalSFM(){}
+GlobalSFM::GlobalSFM(ThreadPool *_thread_pool) : thread_pool(_thread_pool){}
+
+// 各路标点的三角化只读写自身数据，按路标点分段并行
+void GlobalSFM::forEachFeature(const std::function<void(int)> &func)
+{
+	std::function<void(int, int, int)> job = [&](int begin, int end, int)
+	{
+		for (int j = begin; j < end; j++)
+			func(j);
+	};
+	if (thread_pool)
+		thread_pool->parallelFor(feature_num, job);
+	else
+		job(0, feature_num, 0);
+}
 
 void GlobalSFM::triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen::Matrix<double, 3, 4> &Pose1,
 						Vector2d &point0, Vector2d &point1, Vector3d &point_3d)
@@ -87,10 +101,10 @@ void GlobalSFM::triangulateTwoFrames(int frame0, Eigen::Matrix<double, 3, 4> &Po
 									 vector<SFMFeature> &sfm_f)
 {
 	assert(frame0 != frame1);
-	for (int j = 0; j < feature_num; j++)  //遍历sfm_f中的所有路标点
+	forEachFeature([&](int j)  //遍历sfm_f中的所有路标点
 	{
 		if (sfm_f[j].state == true)  //如果路标点已经初始化，则跳过
-			continue;
+			return;
 		bool has_0 = false, has_1 = false;
 		Vector2d point0;
 		Vector2d point1;
@@ -117,7 +131,7 @@ void GlobalSFM::triangulateTwoFrames(int frame0, Eigen::Matrix<double, 3, 4> &Po
 			sfm_f[j].position[2] = point_3d(2);
 			//cout << "trangulated : " << frame1 << "  3d point : "  << j << "  " << point_3d.transpose() << endl;
 		}							  
-	}
+	});
 }
 
 // 	 q w_R_cam t w_R_cam
@@ -206,10 +220,10 @@ bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 		triangulateTwoFrames(i, Pose[i], l, Pose[l], sfm_f);
 	}
 	//5: triangulate all other points
-	for (int j = 0; j < feature_num; j++)
+	forEachFeature([&](int j)
 	{
 		if (sfm_f[j].state == true)
-			continue;
+			return;
 		if ((int)sfm_f[j].observation.size() >= 2)  //对余下的还未初始化、且观测次数不小于2的路标点进行三角初始化
 		{
 			Vector2d point0, point1;
@@ -225,7 +239,7 @@ bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 			sfm_f[j].position[2] = point_3d(2);
 			//cout << "trangulated : " << frame_0 << " " << frame_1 << "  3d point : "  << j << "  " << point_3d.transpose() << endl;
 		}		
-	}
+	});
 
 /*
 	for (int i = 0; i < frame_num; i++)
@@ -286,6 +300,8 @@ bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 	options.linear_solver_type = ceres::DENSE_SCHUR;
 	//options.minimizer_progress_to_stdout = true;
 	options.max_solver_time_in_seconds = 0.2;
+	if (thread_pool)
+		options.num_threads = thread_pool->numThreads();  //与后端线程池的线程数一致
 	ceres::Solver::Summary summary;
 	ceres::Solve(options, &problem, &summary);
 	//std::cout << summary.BriefReport() << "\n";
@@ -19,6 +19,7 @@
 #include <map>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/opencv.hpp>
+#include "../utility/thread_pool.h"
 using namespace Eigen;
 using namespace std;
 
@@ -65,7 +66,7 @@ struct ReprojectionError3D
 class GlobalSFM
 {
 public:
-	GlobalSFM();
+	GlobalSFM(ThreadPool *_thread_pool = nullptr);
 	bool construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 			  const Matrix3d relative_R, const Vector3d relative_T,
 			  vector<SFMFeature> &sfm_f, map<int, Vector3d> &sfm_tracked_points);
@@ -78,6 +79,8 @@ private:
 	void triangulateTwoFrames(int frame0, Eigen::Matrix<double, 3, 4> &Pose0, 
 							  int frame1, Eigen::Matrix<double, 3, 4> &Pose1,
 							  vector<SFMFeature> &sfm_f);
+	void forEachFeature(const std::function<void(int)> &func);
 
 	int feature_num;
+	ThreadPool *thread_pool;  //路标点三角化与BA所用的线程池，为空时单线程执行
 };
\ No newline at end of file
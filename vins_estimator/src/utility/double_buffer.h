@@ -0,0 +1,51 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+
+// 单写者双缓冲：写者写入非活动槽后递增版本号，读者无锁读取，读取期间若版本号变化则重读
+template <typename T>
+class DoubleBuffer
+{
+  public:
+    DoubleBuffer() : version(0)
+    {
+    }
+
+    void write(const T &value)
+    {
+        unsigned int v = version.load(std::memory_order_relaxed);
+        slots[(v + 1) & 1] = value;
+        version.store(v + 1, std::memory_order_release);
+    }
+
+    // 返回读到数据的版本号，0表示尚未写入过
+    unsigned int read(T &value) const
+    {
+        while (true)
+        {
+            unsigned int v = version.load(std::memory_order_acquire);
+            value = slots[v & 1];
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (version.load(std::memory_order_relaxed) == v)
+                return v;
+        }
+    }
+
+    unsigned int currentVersion() const
+    {
+        return version.load(std::memory_order_acquire);
+    }
+
+  private:
+    T slots[2];
+    std::atomic<unsigned int> version;
+};
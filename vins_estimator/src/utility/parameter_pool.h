@@ -0,0 +1,66 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+
+// 定长参数块的分块存储：按chunk整块分配，扩容时已有参数块的地址不变（ceres按地址识别参数块）
+template <int BLOCK_SIZE>
+class ParameterBlockPool
+{
+  public:
+    ParameterBlockPool(int _chunk_size = 256) : chunk_size(_chunk_size), num_blocks(0)
+    {
+    }
+
+    void setChunkSize(int _chunk_size)
+    {
+        if (chunks.empty() && _chunk_size > 0)
+            chunk_size = _chunk_size;
+    }
+
+    void reserve(int n)
+    {
+        while (capacity() < n)
+            chunks.push_back(std::unique_ptr<double[]>(new double[chunk_size * BLOCK_SIZE]));
+    }
+
+    void resize(int n)
+    {
+        reserve(n);
+        num_blocks = n;
+    }
+
+    int size() const
+    {
+        return num_blocks;
+    }
+
+    int capacity() const
+    {
+        return static_cast<int>(chunks.size()) * chunk_size;
+    }
+
+    double *operator[](int i)
+    {
+        return chunks[i / chunk_size].get() + (i % chunk_size) * BLOCK_SIZE;
+    }
+
+    const double *operator[](int i) const
+    {
+        return chunks[i / chunk_size].get() + (i % chunk_size) * BLOCK_SIZE;
+    }
+
+  private:
+    int chunk_size;
+    int num_blocks;
+    std::vector<std::unique_ptr<double[]>> chunks;
+};
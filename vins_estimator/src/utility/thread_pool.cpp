@@ -0,0 +1,110 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool() : thread_count(1), job(nullptr), job_size(0), job_generation(0), pending(0), stop(false)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+    stopWorkers();
+}
+
+void ThreadPool::setNumThreads(int num_threads)
+{
+    std::lock_guard<std::mutex> call_lock(call_mutex);
+    if (num_threads < 1)
+        num_threads = 1;
+    if (num_threads == numThreads())
+        return;
+    stopWorkers();
+    stop = false;
+    thread_count = num_threads;
+    for (int i = 1; i < num_threads; i++)
+        workers.push_back(std::thread(&ThreadPool::workerLoop, this, i, job_generation));
+}
+
+int ThreadPool::numThreads() const
+{
+    return thread_count;
+}
+
+void ThreadPool::parallelFor(int n, const std::function<void(int, int, int)> &func)
+{
+    if (n <= 0)
+        return;
+    std::lock_guard<std::mutex> call_lock(call_mutex);
+    int num_threads = numThreads();
+    if (num_threads == 1 || n == 1)
+    {
+        func(0, n, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        job = &func;
+        job_size = n;
+        pending = num_threads - 1;
+        job_generation++;
+    }
+    job_cv.notify_all();
+
+    func(0, n / num_threads, 0);  //调用线程负责第0段
+
+    std::unique_lock<std::mutex> lock(job_mutex);
+    done_cv.wait(lock, [this] { return pending == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::stopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        stop = true;
+    }
+    job_cv.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+    workers.clear();
+    thread_count = 1;
+}
+
+void ThreadPool::workerLoop(int thread_id, int generation)
+{
+    int seen_generation = generation;
+    while (true)
+    {
+        const std::function<void(int, int, int)> *func;
+        int n, num_threads;
+        {
+            std::unique_lock<std::mutex> lock(job_mutex);
+            job_cv.wait(lock, [this, seen_generation] { return stop || job_generation != seen_generation; });
+            if (stop)
+                return;
+            seen_generation = job_generation;
+            func = job;
+            n = job_size;
+            num_threads = thread_count;
+        }
+
+        int begin = static_cast<long>(n) * thread_id / num_threads;
+        int end = static_cast<long>(n) * (thread_id + 1) / num_threads;
+        if (begin < end)
+            (*func)(begin, end, thread_id);
+
+        {
+            std::lock_guard<std::mutex> lock(job_mutex);
+            pending--;
+        }
+        done_cv.notify_one();
+    }
+}
@@ -0,0 +1,46 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// 常驻线程池，后端各处的数据并行计算共用，避免每次调用都创建线程
+class ThreadPool
+{
+  public:
+    ThreadPool();
+    ~ThreadPool();
+
+    // 线程数包含调用线程本身；num_threads <= 1 时直接在调用线程中串行执行
+    void setNumThreads(int num_threads);
+    int numThreads() const;
+
+    // 将[0, n)均分为numThreads()段并行执行func(begin, end, thread_id)，返回时全部完成
+    void parallelFor(int n, const std::function<void(int, int, int)> &func);
+
+  private:
+    void stopWorkers();
+    void workerLoop(int thread_id, int generation);
+
+    std::vector<std::thread> workers;
+    std::mutex call_mutex;  //同一时刻只允许一个parallelFor
+    std::mutex job_mutex;
+    std::condition_variable job_cv, done_cv;
+    int thread_count;
+    const std::function<void(int, int, int)> *job;
+    int job_size;
+    int job_generation;
+    int pending;
+    bool stop;
+};
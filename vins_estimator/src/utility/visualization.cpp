@@ -24,6 +24,7 @@ ros::Publisher pub_keyframe_point;
 ros::Publisher pub_extrinsic;
 
 ros::Publisher pub_image_track;
+ros::Publisher pub_reproj_histogram;
 
 CameraPoseVisualization cameraposevisual(1, 0, 0, 1);
 static double sum_of_path = 0;
@@ -45,6 +46,7 @@ void registerPub(ros::NodeHandle &n)
     pub_keyframe_point = n.advertise<sensor_msgs::PointCloud>("keyframe_point", 1000);
     pub_extrinsic = n.advertise<nav_msgs::Odometry>("extrinsic", 1000);
     pub_image_track = n.advertise<sensor_msgs::Image>("image_track", 1000);
+    pub_reproj_histogram = n.advertise<std_msgs::Int32MultiArray>("reprojection_histogram", 1000);
 
     cameraposevisual.setScale(0.1);
     cameraposevisual.setLineWidth(0.01);
@@ -83,8 +85,9 @@ void printStatistics(const Estimator &estimator, double t)
     if (estimator.solver_flag != Estimator::SolverFlag::NON_LINEAR)
         return;
     //printf("position: %f, %f, %f\r", estimator.Ps[WINDOW_SIZE].x(), estimator.Ps[WINDOW_SIZE].y(), estimator.Ps[WINDOW_SIZE].z());
-    ROS_DEBUG_STREAM("position: " << estimator.Ps[WINDOW_SIZE].transpose());
-    ROS_DEBUG_STREAM("orientation: " << estimator.Vs[WINDOW_SIZE].transpose());
+    int latest = estimator.frame_count;  //滑窗中最新帧（双目+IMU提前完成初始化时滑窗可能未满）
+    ROS_DEBUG_STREAM("position: " << estimator.Ps[latest].transpose());
+    ROS_DEBUG_STREAM("orientation: " << estimator.Vs[latest].transpose());
     if (ESTIMATE_EXTRINSIC)
     {
         cv::FileStorage fs(EX_CALIB_RESULT_PATH, cv::FileStorage::WRITE);
@@ -114,8 +117,8 @@ void printStatistics(const Estimator &estimator, double t)
     ROS_DEBUG("vo solver costs: %f ms", t);
     ROS_DEBUG("average of time %f ms", sum_of_time / sum_of_calculation);
 
-    sum_of_path += (estimator.Ps[WINDOW_SIZE] - last_path).norm();
-    last_path = estimator.Ps[WINDOW_SIZE];
+    sum_of_path += (estimator.Ps[latest] - last_path).norm();
+    last_path = estimator.Ps[latest];
     ROS_DEBUG("sum of path %f", sum_of_path);
     if (ESTIMATE_TD)
         ROS_INFO("td %f", estimator.td);
@@ -129,18 +132,19 @@ void pubOdometry(const Estimator &estimator, const std_msgs::Header &header)
         odometry.header = header;
         odometry.header.frame_id = "world";
         odometry.child_frame_id = "world";
+        int latest = estimator.frame_count;
         Quaterniond tmp_Q;
-        tmp_Q = Quaterniond(estimator.Rs[WINDOW_SIZE]);
-        odometry.pose.pose.position.x = estimator.Ps[WINDOW_SIZE].x();
-        odometry.pose.pose.position.y = estimator.Ps[WINDOW_SIZE].y();
-        odometry.pose.pose.position.z = estimator.Ps[WINDOW_SIZE].z();
+        tmp_Q = Quaterniond(estimator.Rs[latest]);
+        odometry.pose.pose.position.x = estimator.Ps[latest].x();
+        odometry.pose.pose.position.y = estimator.Ps[latest].y();
+        odometry.pose.pose.position.z = estimator.Ps[latest].z();
         odometry.pose.pose.orientation.x = tmp_Q.x();
         odometry.pose.pose.orientation.y = tmp_Q.y();
         odometry.pose.pose.orientation.z = tmp_Q.z();
         odometry.pose.pose.orientation.w = tmp_Q.w();
-        odometry.twist.twist.linear.x = estimator.Vs[WINDOW_SIZE].x();
-        odometry.twist.twist.linear.y = estimator.Vs[WINDOW_SIZE].y();
-        odometry.twist.twist.linear.z = estimator.Vs[WINDOW_SIZE].z();
+        odometry.twist.twist.linear.x = estimator.Vs[latest].x();
+        odometry.twist.twist.linear.y = estimator.Vs[latest].y();
+        odometry.twist.twist.linear.z = estimator.Vs[latest].z();
         pub_odometry.publish(odometry);
 
         geometry_msgs::PoseStamped pose_stamped;
@@ -158,18 +162,18 @@ void pubOdometry(const Estimator &estimator, const std_msgs::Header &header)
         foutC.precision(0);
         foutC << header.stamp.toSec() * 1e9 << ",";
         foutC.precision(5);
-        foutC << estimator.Ps[WINDOW_SIZE].x() << ","
-              << estimator.Ps[WINDOW_SIZE].y() << ","
-              << estimator.Ps[WINDOW_SIZE].z() << ","
+        foutC << estimator.Ps[latest].x() << ","
+              << estimator.Ps[latest].y() << ","
+              << estimator.Ps[latest].z() << ","
               << tmp_Q.w() << ","
               << tmp_Q.x() << ","
               << tmp_Q.y() << ","
               << tmp_Q.z() << ","
-              << estimator.Vs[WINDOW_SIZE].x() << ","
-              << estimator.Vs[WINDOW_SIZE].y() << ","
-              << estimator.Vs[WINDOW_SIZE].z() << "," << endl;
+              << estimator.Vs[latest].x() << ","
+              << estimator.Vs[latest].y() << ","
+              << estimator.Vs[latest].z() << "," << endl;
         foutC.close();
-        Eigen::Vector3d tmp_T = estimator.Ps[WINDOW_SIZE];
+        Eigen::Vector3d tmp_T = estimator.Ps[latest];
         printf("time: %f, t: %f %f %f q: %f %f %f %f \n", header.stamp.toSec(), tmp_T.x(), tmp_T.y(), tmp_T.z(),
                                                           tmp_Q.w(), tmp_Q.x(), tmp_Q.y(), tmp_Q.z());
     }
@@ -196,7 +200,7 @@ void pubKeyPoses(const Estimator &estimator, const std_msgs::Header &header)
     key_poses.color.r = 1.0;
     key_poses.color.a = 1.0;
 
-    for (int i = 0; i <= WINDOW_SIZE; i++)
+    for (int i = 0; i < (int)estimator.key_poses.size(); i++)
     {
         geometry_msgs::Point pose_marker;
         Vector3d correct_pose;
@@ -211,7 +215,7 @@ void pubKeyPoses(const Estimator &estimator, const std_msgs::Header &header)
 
 void pubCameraPose(const Estimator &estimator, const std_msgs::Header &header)
 {
-    int idx2 = WINDOW_SIZE - 1;
+    int idx2 = estimator.frame_count - 1;
 
     if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR)
     {
@@ -261,7 +265,7 @@ void pubPointCloud(const Estimator &estimator, const std_msgs::Header &header)
         if (it_per_id.start_frame > WINDOW_SIZE * 3.0 / 4.0 || it_per_id.solve_flag != 1)
             continue;
         int imu_i = it_per_id.start_frame;
-        Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
+        Vector3d pts_i = it_per_id.feature_per_frame[0].point() * it_per_id.estimated_depth;
         Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0]) + estimator.Ps[imu_i];
 
         geometry_msgs::Point32 p;
@@ -290,7 +294,7 @@ void pubPointCloud(const Estimator &estimator, const std_msgs::Header &header)
             && it_per_id.solve_flag == 1 )  //发布点的满足的条件：已经初始化、第一次观测的图像帧在第0帧，被观测的图像帧数小于2 tzhang
         {
             int imu_i = it_per_id.start_frame;
-            Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
+            Vector3d pts_i = it_per_id.feature_per_frame[0].point() * it_per_id.estimated_depth;
             Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0]) + estimator.Ps[imu_i];
 
             geometry_msgs::Point32 p;
@@ -304,6 +308,24 @@ void pubPointCloud(const Estimator &estimator, const std_msgs::Header &header)
 }
 
 
+void pubReprojectionHistogram(const Estimator &estimator)  //发布左右相机的重投影误差直方图，每个区间0.5像素
+{
+    if (estimator.solver_flag != Estimator::SolverFlag::NON_LINEAR)
+        return;
+    std_msgs::Int32MultiArray histogram;
+    histogram.layout.dim.resize(2);
+    histogram.layout.dim[0].label = "camera";
+    histogram.layout.dim[0].size = NUM_OF_CAM;
+    histogram.layout.dim[0].stride = NUM_OF_CAM * REPROJ_HIST_BINS;
+    histogram.layout.dim[1].label = "bin";
+    histogram.layout.dim[1].size = REPROJ_HIST_BINS;
+    histogram.layout.dim[1].stride = REPROJ_HIST_BINS;
+    for (int c = 0; c < NUM_OF_CAM; c++)
+        for (int b = 0; b < REPROJ_HIST_BINS; b++)
+            histogram.data.push_back(estimator.reproj_histogram[c][b]);
+    pub_reproj_histogram.publish(histogram);
+}
+
 void pubTF(const Estimator &estimator, const std_msgs::Header &header)
 {
     if( estimator.solver_flag != Estimator::SolverFlag::NON_LINEAR)
@@ -314,8 +336,8 @@ void pubTF(const Estimator &estimator, const std_msgs::Header &header)
     // body frame
     Vector3d correct_t;
     Quaterniond correct_q;
-    correct_t = estimator.Ps[WINDOW_SIZE];
-    correct_q = estimator.Rs[WINDOW_SIZE];
+    correct_t = estimator.Ps[estimator.frame_count];
+    correct_q = estimator.Rs[estimator.frame_count];
 
     transform.setOrigin(tf::Vector3(correct_t(0),
                                     correct_t(1),
@@ -357,7 +379,8 @@ void pubTF(const Estimator &estimator, const std_msgs::Header &header)
 void pubKeyframe(const Estimator &estimator)
 {
     // pub camera pose, 2D-3D points of keyframe
-    if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR && estimator.marginalization_flag == 0)  //当MARGIN_OLD时才发布 tzhang
+    if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR && estimator.marginalization_flag == 0 &&
+        estimator.frame_count == WINDOW_SIZE)  //当MARGIN_OLD且滑窗已满时才发布 tzhang
     {
         int i = WINDOW_SIZE - 2;
         //Vector3d P = estimator.Ps[i] + estimator.Rs[i] * estimator.tic[0];
@@ -389,7 +412,7 @@ void pubKeyframe(const Estimator &estimator)
             {
 
                 int imu_i = it_per_id.start_frame;
-                Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
+                Vector3d pts_i = it_per_id.feature_per_frame[0].point() * it_per_id.estimated_depth;
                 Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0])
                                       + estimator.Ps[imu_i];
                 geometry_msgs::Point32 p;
@@ -400,10 +423,10 @@ void pubKeyframe(const Estimator &estimator)
 
                 int imu_j = WINDOW_SIZE - 2 - it_per_id.start_frame;  
                 sensor_msgs::ChannelFloat32 p_2d;
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].point.x());
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].point.y());
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].uv.x());
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].uv.y());
+                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].point().x());
+                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].point().y());
+                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].uv().x());
+                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].uv().y());
                 p_2d.values.push_back(it_per_id.feature_id);
                 point_cloud.channels.push_back(p_2d);  //路标点在WINDOW_SIZE - 2图像帧中的信息
             }
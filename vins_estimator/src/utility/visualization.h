@@ -13,6 +13,7 @@
 #include <std_msgs/Header.h>
 #include <std_msgs/Float32.h>
 #include <std_msgs/Bool.h>
+#include <std_msgs/Int32MultiArray.h>
 #include <sensor_msgs/Imu.h>
 #include <sensor_msgs/PointCloud.h>
 #include <sensor_msgs/Image.h>
@@ -59,6 +60,8 @@ void pubPointCloud(const Estimator &estimator, const std_msgs::Header &header);
 
 void pubTF(const Estimator &estimator, const std_msgs::Header &header);
 
+void pubReprojectionHistogram(const Estimator &estimator);
+
 void pubKeyframe(const Estimator &estimator);
 
 void pubRelocalization(const Estimator &estimator);